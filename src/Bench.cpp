@@ -0,0 +1,13 @@
+/**
+ * @file Bench.cpp
+ * @author Grama Nicolae (gramanicu@gmail.com)
+ * @brief Benchmark suite, generates a corpus and measures the parser
+ * @copyright Copyright (c) 2020
+ */
+
+#include "./GenreParser/Benchmark.hpp"
+
+int main(int argc, char *argv[]) {
+    GenreParser::Benchmark benchmark(argc, argv);
+    return benchmark.run() ? 0 : 1;
+}
\ No newline at end of file
@@ -0,0 +1,49 @@
+/**
+ * @file Batch.cpp
+ * @author Grama Nicolae (gramanicu@gmail.com)
+ * @brief Batch framing implementation
+ * @copyright Copyright (c) 2020
+ */
+
+#include "Batch.hpp"
+
+#include "Helpers.hpp"
+
+namespace GenreParser::Batch {
+    Header::Header() : fields{0, 0} {}
+
+    void Header::add(size_t size) {
+        fields.push_back(fields.back() + size);
+        fields[0]++;
+    }
+
+    size_t Header::count() const { return fields[0]; }
+
+    size_t Header::payload_size() const { return fields.back(); }
+
+    const char* Header::data() const {
+        return reinterpret_cast<const char*>(fields.data());
+    }
+
+    size_t Header::size() const { return fields.size() * sizeof(uint32_t); }
+
+    View::View(const char* data, size_t size) {
+        Conditions::MUST(size >= header_size(0), "Batch: Invalid header\n");
+        offsets = reinterpret_cast<const uint32_t*>(data);
+        paragraphs = offsets[0];
+        offsets++;
+
+        Conditions::MUST(size >= header_size(paragraphs) &&
+                             size - header_size(paragraphs) ==
+                                 offsets[paragraphs],
+                         "Batch: Invalid header\n");
+        payload = data + header_size(paragraphs);
+    }
+
+    size_t View::count() const { return paragraphs; }
+
+    std::string_view View::operator[](size_t index) const {
+        return std::string_view(payload + offsets[index],
+                                offsets[index + 1] - offsets[index]);
+    }
+}    // namespace GenreParser::Batch
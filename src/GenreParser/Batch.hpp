@@ -0,0 +1,71 @@
+/**
+ * @file Batch.hpp
+ * @author Grama Nicolae (gramanicu@gmail.com)
+ * @brief Framing of multiple paragraphs in a single message
+ * @copyright Copyright (c) 2020
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace GenreParser::Batch {
+    /**
+     * @brief The header of a batch. It contains the number of paragraphs,
+     * followed by count + 1 offsets (the start of each paragraph in the data
+     * that follows the header, and the end of the last one)
+     */
+    class Header {
+       private:
+        std::vector<uint32_t> fields;
+
+       public:
+        Header();
+
+        /**
+         * @brief Add a paragraph at the end of the batch
+         * @param size The size of the paragraph
+         */
+        void add(size_t size);
+
+        size_t count() const;
+        size_t payload_size() const;
+
+        /**
+         * @brief The header, as it is sent before the paragraphs
+         */
+        const char* data() const;
+        size_t size() const;
+    };
+
+    /**
+     * @brief A received batch. The paragraphs point inside the message
+     */
+    class View {
+       private:
+        const char* payload = nullptr;
+        const uint32_t* offsets = nullptr;
+        size_t paragraphs = 0;
+
+       public:
+        /**
+         * @brief Parse the header of a received message
+         * @param data The message
+         * @param size The size of the message
+         */
+        View(const char* data, size_t size);
+
+        size_t count() const;
+        std::string_view operator[](size_t index) const;
+    };
+
+    /**
+     * @brief The size of the header of a batch
+     * @param count The number of paragraphs in the batch
+     */
+    inline size_t header_size(size_t count) {
+        return (count + 2) * sizeof(uint32_t);
+    }
+}    // namespace GenreParser::Batch
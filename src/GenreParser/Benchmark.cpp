@@ -0,0 +1,220 @@
+/**
+ * @file Benchmark.cpp
+ * @author Grama Nicolae (gramanicu@gmail.com)
+ * @brief Benchmarks implementation
+ * @copyright Copyright (c) 2020
+ */
+
+#include "Benchmark.hpp"
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+
+#include "Genres.hpp"
+#include "Kernels.hpp"
+#include "Options.hpp"
+
+namespace GenreParser {
+    namespace {
+        using Clock = std::chrono::steady_clock;
+
+        double seconds_since(Clock::time_point start) {
+            return std::chrono::duration<double>(Clock::now() - start).count();
+        }
+
+        /**
+         * @brief The size of a file, or 0 if it doesn't exist
+         */
+        size_t file_size(const std::string& path) {
+            struct stat info;
+            return stat(path.c_str(), &info) == 0 ? info.st_size : 0;
+        }
+    }    // namespace
+
+    Benchmark::Benchmark(int argc, char* argv[]) {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg(argv[i]);
+            const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+            Conditions::MUST(value != nullptr, arg + ": Value not provided\n");
+            ++i;
+
+            if (arg == "--size") {
+                shape.size = parse_size(arg, value);
+            } else if (arg == "--paragraph-size") {
+                shape.paragraph_size = parse_size(arg, value);
+            } else if (arg == "--line-size") {
+                shape.line_size = parse_size(arg, value);
+            } else if (arg == "--skew") {
+                char* end;
+                shape.skew = std::strtod(value, &end);
+                Conditions::MUST(*end == '\0' && shape.skew >= 0 &&
+                                     shape.skew <= 1,
+                                 arg + ": Expected a value between 0 and 1\n");
+            } else if (arg == "--seed") {
+                shape.seed = parse_number(arg, value);
+            } else if (arg == "--corpus") {
+                corpus_path = value;
+            } else if (arg == "--program") {
+                program = value;
+            } else if (arg == "--launcher") {
+                launcher = value;
+            } else if (arg == "--args") {
+                program_args = value;
+            } else if (arg == "--ranks") {
+                // A comma-separated list
+                ranks.clear();
+                std::stringstream list(value);
+                std::string count;
+                while (std::getline(list, count, ',')) {
+                    ranks.push_back(parse_number(arg, count.c_str()));
+                }
+            } else if (arg == "--repeat") {
+                repeat = parse_number(arg, value);
+            } else if (arg == "--kernel-size") {
+                kernel_size = parse_size(arg, value);
+            } else if (arg == "--only") {
+                only = value;
+                Conditions::MUST(only == "all" || only == "corpus" ||
+                                     only == "kernels" || only == "e2e",
+                                 arg + ": Expected all, corpus, kernels or "
+                                       "e2e\n");
+            } else {
+                Conditions::MUST(false, arg + ": Unknown option\n");
+            }
+        }
+    }
+
+    void Benchmark::report(const std::string& fields, size_t bytes,
+                           const std::vector<double>& seconds) const {
+        std::vector<double> speeds;
+        for (double time : seconds) { speeds.push_back(bytes / time / 1e6); }
+
+        double mean = 0, variance = 0;
+        for (double speed : speeds) { mean += speed; }
+        mean /= speeds.size();
+        for (double speed : speeds) {
+            variance += (speed - mean) * (speed - mean);
+        }
+        if (speeds.size() > 1) { variance /= speeds.size() - 1; }
+
+        std::stringstream runs;
+        for (size_t i = 0; i < speeds.size(); ++i) {
+            runs << (i == 0 ? "" : ",") << speeds[i];
+        }
+
+        std::cout << "{" << fields << ",\"bytes\":" << bytes << ",\"mb_s\":["
+                  << runs.str() << "],\"mean\":" << mean
+                  << ",\"stddev\":" << std::sqrt(variance)
+                  << ",\"min\":"
+                  << *std::min_element(speeds.begin(), speeds.end())
+                  << ",\"max\":"
+                  << *std::max_element(speeds.begin(), speeds.end()) << "}"
+                  << std::endl;
+    }
+
+    void Benchmark::run_kernels() const {
+        // The lines have the same shape as the ones of the corpus
+        Corpus corpus(shape);
+        std::vector<std::string> lines;
+        size_t bytes = 0, max_line = 0;
+        while (bytes < kernel_size) {
+            lines.push_back(corpus.line());
+            bytes += lines.back().size();
+            max_line = std::max(max_line, lines.back().size());
+        }
+
+        for (auto level : {Kernels::Level::Scalar, Kernels::Level::SSE42,
+                           Kernels::Level::AVX2}) {
+            if (level > Kernels::detect()) { continue; }
+
+            for (size_t i = 0; i < Genres::Registry::count; ++i) {
+                auto type = static_cast<Enums::GenresType>(i);
+                std::vector<double> seconds;
+
+                Kernels::visit(level, [&](auto set) {
+                    using Set = decltype(set);
+
+                    Genres::Registry::visit(type, [&](auto genre) {
+                        using Genre = decltype(genre);
+
+                        // The output has room for the largest line (horror
+                        // doubles the consonants)
+                        std::vector<char> output(2 * max_line + 1);
+                        for (int run = 0; run < repeat; ++run) {
+                            auto start = Clock::now();
+                            for (auto& line : lines) {
+                                Genre::template transform<Set>(
+                                    line.data(), line.size(), output.data(), 0);
+                            }
+                            seconds.push_back(seconds_since(start));
+                        }
+                    });
+                });
+
+                report("\"bench\":\"kernels\",\"genre\":\"" +
+                           Enums::to_string(type) + "\",\"simd\":\"" +
+                           Kernels::to_string(level) + "\"",
+                       bytes, seconds);
+            }
+        }
+    }
+
+    bool Benchmark::run_program() const {
+        size_t bytes = file_size(corpus_path);
+        bool succeeded = true;
+
+        for (int count : ranks) {
+            std::string command = launcher + " -np " + std::to_string(count) +
+                                  " " + program + " " + program_args + " " +
+                                  corpus_path;
+            std::string fields =
+                "\"bench\":\"e2e\",\"ranks\":" + std::to_string(count);
+            std::vector<double> seconds;
+            int status = 0;
+
+            for (int run = 0; run < repeat && status == 0; ++run) {
+                auto start = Clock::now();
+                status = std::system(command.c_str());
+                seconds.push_back(seconds_since(start));
+            }
+
+            // A failed launch (for example, more ranks than the available
+            // slots) is reported, and the other rank counts are still run
+            if (status != 0) {
+                std::cerr << "Failed: " << command << std::endl;
+                int code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+                std::cout << "{" << fields << ",\"failed\":true,\"status\":"
+                          << code << "}" << std::endl;
+                succeeded = false;
+                continue;
+            }
+            report(fields, bytes, seconds);
+        }
+        return succeeded;
+    }
+
+    bool Benchmark::run() {
+        // The corpus is reused by the e2e benchmarks, if it exists
+        if (only == "all" || only == "corpus" ||
+            (only == "e2e" && file_size(corpus_path) == 0)) {
+            auto start = Clock::now();
+            Conditions::MUST(Corpus(shape).write(corpus_path),
+                             corpus_path + ": Corpus could not be written\n");
+            std::cout << "{\"bench\":\"corpus\",\"path\":\"" << corpus_path
+                      << "\",\"bytes\":" << file_size(corpus_path)
+                      << ",\"seconds\":" << seconds_since(start) << "}"
+                      << std::endl;
+        }
+
+        if (only == "all" || only == "kernels") { run_kernels(); }
+        if (only == "all" || only == "e2e") { return run_program(); }
+        return true;
+    }
+}    // namespace GenreParser
@@ -0,0 +1,68 @@
+/**
+ * @file Benchmark.hpp
+ * @author Grama Nicolae (gramanicu@gmail.com)
+ * @brief Benchmarks of the line transformations and of the whole program
+ * @copyright Copyright (c) 2020
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "Corpus.hpp"
+
+namespace GenreParser {
+    class Benchmark {
+       private:
+        CorpusShape shape;
+        std::string corpus_path = "bench.txt";
+        std::string program = "./main";
+        std::string launcher = "mpirun";
+        std::string program_args;
+        std::vector<int> ranks = {2, 5, 9};
+        int repeat = 5;
+        size_t kernel_size = 8 << 20;
+
+        // Which benchmarks are run: "all", "corpus", "kernels" or "e2e"
+        std::string only = "all";
+
+        /**
+         * @brief Print a result as a JSON line: the throughput of every run,
+         * their mean, standard deviation, minimum and maximum (in MB/s)
+         * @param fields The fields that identify the benchmark, as JSON
+         * @param bytes The bytes processed by each run
+         * @param seconds The duration of each run
+         */
+        void report(const std::string& fields, size_t bytes,
+                    const std::vector<double>& seconds) const;
+
+        /**
+         * @brief Measure the transformation of each genre (the work done by
+         * Parser::process_lines), with each supported instruction set
+         */
+        void run_kernels() const;
+
+        /**
+         * @brief Measure the whole program on the corpus, with each number
+         * of processes. A count whose launch fails is reported as failed,
+         * and the next counts are still measured
+         * @return false if any of the launches failed, true otherwise
+         */
+        bool run_program() const;
+
+       public:
+        /**
+         * @brief Parse the command line arguments ("--name value")
+         * @param argc The number of arguments
+         * @param argv The arguments
+         */
+        Benchmark(int argc, char* argv[]);
+
+        /**
+         * @brief Run the selected benchmarks
+         * @return false if any of the program runs failed, true otherwise
+         */
+        bool run();
+    };
+}    // namespace GenreParser
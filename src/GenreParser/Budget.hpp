@@ -0,0 +1,76 @@
+/**
+ * @file Budget.hpp
+ * @author Grama Nicolae (gramanicu@gmail.com)
+ * @brief Memory budget, used to limit the data kept by the master
+ * @copyright Copyright (c) 2020
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+
+namespace GenreParser::Utilities {
+    /**
+     * @brief Counts the bytes that are in use. A thread that needs more bytes
+     * than the remaining ones waits until enough bytes are released
+     */
+    class MemoryBudget {
+       private:
+        size_t limit = 0;
+        size_t used = 0;
+        std::mutex mutex;
+        std::condition_variable released;
+
+       public:
+        /**
+         * @brief Set the maximum number of bytes in use
+         * @param bytes The limit, or 0 for no limit
+         */
+        void set_limit(size_t bytes) { limit = bytes; }
+
+        bool is_limited() const { return limit != 0; }
+
+        /**
+         * @brief Reserve bytes, waiting until they are available. A request
+         * larger than the limit is granted when nothing else is in use
+         * @param bytes The number of bytes
+         */
+        void acquire(size_t bytes) {
+            if (limit == 0) { return; }
+
+            std::unique_lock<std::mutex> lock(mutex);
+            released.wait(lock,
+                          [&] { return used == 0 || used + bytes <= limit; });
+            used += bytes;
+        }
+
+        /**
+         * @brief Reserve bytes, only if they are available now
+         * @param bytes The number of bytes
+         * @return false if the bytes were not reserved
+         */
+        bool try_acquire(size_t bytes) {
+            if (limit == 0) { return true; }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (used + bytes > limit) { return false; }
+            used += bytes;
+            return true;
+        }
+
+        /**
+         * @brief Release bytes reserved with acquire or try_acquire
+         * @param bytes The number of bytes
+         */
+        void release(size_t bytes) {
+            if (limit == 0) { return; }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                used -= bytes;
+            }
+            released.notify_all();
+        }
+    };
+}    // namespace GenreParser::Utilities
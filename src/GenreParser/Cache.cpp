@@ -0,0 +1,452 @@
+/**
+ * @file Cache.cpp
+ * @author Grama Nicolae (gramanicu@gmail.com)
+ * @brief Processed paragraphs cache implementation
+ * @copyright Copyright (c) 2020
+ */
+
+#include "Cache.hpp"
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <unordered_set>
+#include <vector>
+
+#include "Helpers.hpp"
+
+namespace GenreParser {
+    namespace {
+        const uint64_t MULTIPLIERS[2] = {0x9E3779B97F4A7C15ull,
+                                         0xC2B2AE3D27D4EB4Full};
+
+        // Changed when the output of the transformations changes, so the
+        // entries of the previous versions are never found
+        const uint64_t VERSION = 1;
+
+        uint64_t rotate(uint64_t value, int bits) {
+            return (value << bits) | (value >> (64 - bits));
+        }
+
+        /**
+         * @brief The finalizer of splitmix64, that spreads every bit of the
+         * value over the whole result
+         */
+        uint64_t mix(uint64_t value) {
+            value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+            value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+            return value ^ (value >> 31);
+        }
+
+        const char* const PACK = "pack";
+        const char* const RECENCY = "recency";
+
+        // The appender writes at most this many bytes at once
+        const size_t APPEND_BYTES = 1 << 20;
+
+        // The inserts waiting for the appender take at most this many bytes
+        const size_t QUEUE_BYTES = 64 << 20;
+
+        /**
+         * @brief The start of an entry in the pack, followed by its data
+         */
+        struct Record {
+            uint64_t high;
+            uint64_t low;
+            uint64_t size;
+        };
+
+        /**
+         * @brief Write all the data at an offset of a file
+         * @return false if the data could not be written
+         */
+        bool write_all(int fd, const char* data, size_t size, uint64_t offset) {
+            while (size > 0) {
+                ssize_t written = pwrite(fd, data, size, offset);
+                if (written < 0 && errno == EINTR) { continue; }
+                if (written <= 0) { return false; }
+                data += written;
+                size -= written;
+                offset += written;
+            }
+            return true;
+        }
+
+        /**
+         * @brief Read all the data at an offset of a file
+         * @return false if the data could not be read
+         */
+        bool read_all(int fd, char* data, size_t size, uint64_t offset) {
+            while (size > 0) {
+                ssize_t count = pread(fd, data, size, offset);
+                if (count < 0 && errno == EINTR) { continue; }
+                if (count <= 0) { return false; }
+                data += count;
+                size -= count;
+                offset += count;
+            }
+            return true;
+        }
+    }    // namespace
+
+    Hasher::Hasher() : lanes{VERSION, ~VERSION} {}
+
+    void Hasher::absorb(uint64_t value) {
+        for (int i = 0; i < 2; ++i) {
+            lanes[i] = rotate((lanes[i] ^ value) * MULTIPLIERS[i], 31 - 2 * i);
+        }
+    }
+
+    void Hasher::update(const char* data, size_t count) {
+        // Complete the word started by the previous piece
+        for (; count > 0 && size % 8 != 0; ++data, --count) {
+            word |= (uint64_t)(uint8_t)*data << (8 * (size % 8));
+            if (++size % 8 == 0) {
+                absorb(word);
+                word = 0;
+            }
+        }
+
+        for (; count >= 8; data += 8, count -= 8, size += 8) {
+            uint64_t value;
+            std::memcpy(&value, data, sizeof(value));
+            absorb(value);
+        }
+
+        for (; count > 0; ++data, --count, ++size) {
+            word |= (uint64_t)(uint8_t)*data << (8 * (size % 8));
+        }
+    }
+
+    CacheKey Hasher::finish() const {
+        Hasher last = *this;
+        if (size % 8 != 0) { last.absorb(word); }
+        return {mix(last.lanes[0] ^ size),
+                mix(last.lanes[1] + mix(last.lanes[0]) + size)};
+    }
+
+    ResultCache::ResultCache(const std::string& directory, size_t capacity,
+                             Utilities::MemoryBudget& budget)
+        : directory(directory), capacity(capacity), budget(budget) {
+        mkdir(directory.c_str(), 0755);
+        pack = open(path(PACK).c_str(), O_RDWR | O_CREAT, 0644);
+        Conditions::MUST(pack >= 0,
+                         directory + ": Cache could not be opened\n");
+        Conditions::MUST(flock(pack, LOCK_EX | LOCK_NB) == 0,
+                         directory + ": Cache is used by another run\n");
+
+        load();
+        appender = std::thread(&ResultCache::append, this);
+    }
+
+    ResultCache::~ResultCache() { close(); }
+
+    void ResultCache::close() {
+        if (pack < 0) { return; }
+        inserts.close();
+        if (appender.joinable()) { appender.join(); }
+
+        // Reclaim the space of the entries evicted after the last append
+        if (is_wasteful()) { compact(); }
+        save_recency();
+        if (map != nullptr) { munmap((void*)map, map_size); }
+        ::close(pack);
+        pack = -1;
+    }
+
+    std::string ResultCache::path(const std::string& name) const {
+        return directory + "/" + name;
+    }
+
+    void ResultCache::load() {
+        // The records of the pack. A record that was not completely written
+        // (the run was stopped) is cut off
+        struct stat info;
+        Conditions::MUST(fstat(pack, &info) == 0,
+                         directory + ": Cache could not be opened\n");
+        uint64_t file_size = info.st_size;
+
+        std::vector<Entry> records;
+        std::unordered_map<CacheKey, size_t, KeyHash> latest;
+        uint64_t offset = 0;
+        while (file_size - offset >= sizeof(Record)) {
+            Record record;
+            if (pread(pack, &record, sizeof(record), offset) !=
+                sizeof(record)) {
+                break;
+            }
+            uint64_t data = offset + sizeof(record);
+            if (record.size > file_size - data) { break; }
+
+            CacheKey key{record.high, record.low};
+            latest[key] = records.size();
+            records.push_back({key, data, record.size});
+            offset = data + record.size;
+        }
+        if (offset != file_size) { ftruncate(pack, offset); }
+        pack_size = offset;
+
+        // The entries found in the next runs are read from the map, without
+        // a system call for each one
+        if (pack_size != 0) {
+            void* addr =
+                mmap(nullptr, pack_size, PROT_READ, MAP_SHARED, pack, 0);
+            if (addr != MAP_FAILED) {
+                map = static_cast<const char*>(addr);
+                map_size = pack_size;
+            }
+        }
+
+        // The entries that were used in the previous runs, in their order
+        std::ifstream recency(path(RECENCY), std::ios::binary);
+        CacheKey key;
+        while (recency.read((char*)&key, sizeof(key))) {
+            auto it = latest.find(key);
+            if (it == latest.end() || index.count(key) != 0) { continue; }
+            entries.push_back(records[it->second]);
+            index[key] = std::prev(entries.end());
+            used += entries.back().size;
+        }
+
+        // The entries that were added after the order was saved are the most
+        // recent ones
+        for (size_t i = 0; i < records.size(); ++i) {
+            const CacheKey& record_key = records[i].key;
+            if (latest[record_key] != i || index.count(record_key) != 0) {
+                continue;
+            }
+            entries.push_front(records[i]);
+            index[record_key] = entries.begin();
+            used += records[i].size;
+        }
+        evict();
+    }
+
+    void ResultCache::evict() {
+        while (used > capacity && !entries.empty()) {
+            Entry& entry = entries.back();
+            used -= entry.size;
+            index.erase(entry.key);
+            entries.pop_back();
+            evictions++;
+        }
+    }
+
+    bool ResultCache::is_wasteful() const {
+        // The slack is large enough for the pack to be rewritten rarely
+        uint64_t live = used + entries.size() * sizeof(Record);
+        uint64_t slack = std::max<uint64_t>(capacity / 4, APPEND_BYTES);
+        return pack_size > live + slack;
+    }
+
+    void ResultCache::append() {
+        Insert insert;
+        std::vector<char> buffer;
+        std::vector<Entry> added;
+        std::unordered_set<CacheKey, KeyHash> batched;
+
+        // The pack can be larger than needed, if the previous run was
+        // stopped, or the capacity was decreased
+        bool wasteful;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            wasteful = is_wasteful();
+        }
+        bool failed = wasteful && !compact();
+
+        while (inserts.pop(insert)) {
+            buffer.clear();
+            added.clear();
+            batched.clear();
+            do {
+                queued -= insert.data.size();
+                budget.release(insert.data.size());
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (index.count(insert.key) != 0) { continue; }
+                }
+                if (!batched.insert(insert.key).second) { continue; }
+
+                Record record{insert.key.high, insert.key.low,
+                              insert.data.size()};
+                const char* header = (const char*)&record;
+                buffer.insert(buffer.end(), header, header + sizeof(record));
+                added.push_back(
+                    {insert.key, pack_size + buffer.size(), record.size});
+                buffer.insert(buffer.end(), insert.data.begin(),
+                              insert.data.end());
+            } while (buffer.size() < APPEND_BYTES && inserts.try_pop(insert));
+
+            // If the disk is full (or the pack can't be compacted), the cache
+            // just stops growing
+            if (failed || buffer.empty()) { continue; }
+            if (!write_all(pack, buffer.data(), buffer.size(), pack_size)) {
+                failed = true;
+                ftruncate(pack, pack_size);
+                continue;
+            }
+            pack_size += buffer.size();
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                for (auto& entry : added) {
+                    if (index.count(entry.key) != 0) { continue; }
+                    entries.push_front(entry);
+                    index[entry.key] = entries.begin();
+                    used += entry.size;
+                }
+                evict();
+                wasteful = is_wasteful();
+            }
+            if (wasteful && !compact()) { failed = true; }
+        }
+    }
+
+    bool ResultCache::compact() {
+        // The entries, the oldest first, as if they were appended in order.
+        // Only the appender adds entries, so the ones that are not copied
+        // can only be evicted in the meantime
+        std::vector<Entry> live;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            live.assign(entries.rbegin(), entries.rend());
+        }
+
+        std::string temporary = path(PACK) + ".tmp";
+        int compacted = open(temporary.c_str(), O_RDWR | O_CREAT | O_TRUNC,
+                             0644);
+        if (compacted < 0) { return false; }
+
+        std::vector<char> buffer;
+        uint64_t offset = 0;
+        bool written = true;
+        for (auto it = live.begin(); written && it != live.end(); ++it) {
+            Record record{it->key.high, it->key.low, it->size};
+            buffer.resize(sizeof(record) + it->size);
+            std::memcpy(buffer.data(), &record, sizeof(record));
+            written = read_all(pack, buffer.data() + sizeof(record), it->size,
+                               it->offset) &&
+                      write_all(compacted, buffer.data(), buffer.size(),
+                                offset);
+            it->offset = offset + sizeof(record);
+            offset += buffer.size();
+        }
+
+        // The new pack is locked before it replaces the old one, so no other
+        // run can open it
+        if (!written || flock(compacted, LOCK_EX | LOCK_NB) != 0 ||
+            rename(temporary.c_str(), path(PACK).c_str()) != 0) {
+            ::close(compacted);
+            unlink(temporary.c_str());
+            return false;
+        }
+
+        // The entries are read from the new pack from now on
+        std::unique_lock<std::shared_mutex> files_lock(files);
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& entry : live) {
+            auto it = index.find(entry.key);
+            if (it != index.end()) { it->second->offset = entry.offset; }
+        }
+        if (map != nullptr) { munmap((void*)map, map_size); }
+        map = nullptr;
+        map_size = 0;
+        if (offset != 0) {
+            void* addr =
+                mmap(nullptr, offset, PROT_READ, MAP_SHARED, compacted, 0);
+            if (addr != MAP_FAILED) {
+                map = static_cast<const char*>(addr);
+                map_size = offset;
+            }
+        }
+        ::close(pack);
+        pack = compacted;
+        pack_size = offset;
+        return true;
+    }
+
+    void ResultCache::save_recency() {
+        std::string temporary = path(RECENCY) + ".tmp";
+        {
+            std::ofstream recency(temporary, std::ios::binary);
+            for (auto& entry : entries) {
+                recency.write((const char*)&entry.key, sizeof(entry.key));
+            }
+            if (!recency.good()) {
+                unlink(temporary.c_str());
+                return;
+            }
+        }
+        if (rename(temporary.c_str(), path(RECENCY).c_str()) != 0) {
+            unlink(temporary.c_str());
+        }
+    }
+
+    bool ResultCache::find(const CacheKey& key, std::string& data) {
+        // The pack can't be replaced while the entry is read
+        std::shared_lock<std::shared_mutex> files_lock(files);
+        Entry entry;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = index.find(key);
+            if (it == index.end()) {
+                misses++;
+                return false;
+            }
+
+            // Move the entry to the front
+            entries.splice(entries.begin(), entries, it->second);
+            entry = *it->second;
+        }
+
+        // The pack is only appended to until it is replaced, so the entry is
+        // still there, even if it was evicted in the meantime
+        if (entry.offset + entry.size <= map_size) {
+            data.assign(map + entry.offset, entry.size);
+            hits++;
+            return true;
+        }
+        data.resize(entry.size);
+        if (!read_all(pack, &data[0], entry.size, entry.offset)) {
+            misses++;
+            return false;
+        }
+        hits++;
+        return true;
+    }
+
+    void ResultCache::insert(const CacheKey& key, std::string_view data) {
+        if (data.size() > capacity) { return; }
+
+        // The cache is best-effort, so an entry is dropped when the appender
+        // is behind, or the memory budget is used up
+        if (queued.fetch_add(data.size()) + data.size() > QUEUE_BYTES) {
+            queued -= data.size();
+            return;
+        }
+        if (!budget.try_acquire(data.size())) {
+            queued -= data.size();
+            return;
+        }
+        inserts.push({key, std::string(data)});
+    }
+
+    void ResultCache::report(std::ostream& os) {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t lookups = hits + misses;
+        os << "Cache (" << directory << "): " << hits << " hits, " << misses
+           << " misses (" << std::fixed << std::setprecision(1)
+           << (lookups == 0 ? 0.0 : 100.0 * hits / lookups) << "% hits), "
+           << entries.size() << " entries, " << used << " bytes, "
+           << evictions << " evicted\n";
+    }
+}    // namespace GenreParser
@@ -0,0 +1,206 @@
+/**
+ * @file Cache.hpp
+ * @author Grama Nicolae (gramanicu@gmail.com)
+ * @brief On-disk cache of the processed paragraphs, used by the master
+ * @copyright Copyright (c) 2020
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <ostream>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+
+#include "Budget.hpp"
+#include "Queue.hpp"
+
+namespace GenreParser {
+    /**
+     * @brief The key of a paragraph in the cache: a 128 bit hash of the data
+     * sent to a worker (which starts with the header line, so it includes
+     * the genre)
+     */
+    struct CacheKey {
+        uint64_t high = 0;
+        uint64_t low = 0;
+
+        bool operator==(const CacheKey& other) const {
+            return high == other.high && low == other.low;
+        }
+    };
+
+    /**
+     * @brief Hashes data that comes in multiple pieces, 8 bytes at a time, on
+     * two lanes with different multipliers. The result only depends on the
+     * bytes, not on how they are split in pieces
+     */
+    class Hasher {
+       private:
+        uint64_t lanes[2];
+        uint64_t word = 0;    // The bytes that don't fill a word yet
+        size_t size = 0;
+
+        void absorb(uint64_t value);
+
+       public:
+        Hasher();
+
+        void update(const char* data, size_t count);
+        CacheKey finish() const;
+    };
+
+    /**
+     * @brief Keeps the processed paragraphs in a single pack file, in the
+     * cache directory, and the index of the entries (their key, offset and
+     * size) in memory. The new entries are appended to the pack by a
+     * background thread, so the threads that insert the entries don't wait
+     * for the disk. The entries waiting to be appended are limited, and
+     * charged to the memory budget; an entry that doesn't fit is not added.
+     * When the entries are larger than the capacity, the least recently used
+     * ones are removed from the index. When the removed entries take more
+     * than a quarter of the capacity (at least 1MB) in the pack, the
+     * appender rewrites the pack without them, so the pack stays close to
+     * the capacity, even during a run. The recency of the entries is saved
+     * when the cache is closed, so it is preserved between runs
+     * It can be used by multiple threads at the same time, but only by a
+     * single run
+     */
+    class ResultCache {
+       private:
+        struct KeyHash {
+            size_t operator()(const CacheKey& key) const { return key.low; }
+        };
+
+        struct Entry {
+            CacheKey key;
+            uint64_t offset;    // Of the data, in the pack
+            uint64_t size;
+        };
+
+        struct Insert {
+            CacheKey key;
+            std::string data;
+        };
+
+        std::string directory;
+        size_t capacity;
+        Utilities::MemoryBudget& budget;
+        int pack = -1;
+        uint64_t pack_size = 0;    // Only changed by the appender
+
+        // The part of the pack that existed when it was opened (or
+        // compacted), mapped
+        const char* map = nullptr;
+        size_t map_size = 0;
+
+        // Locked (exclusively) when the pack is replaced by a compacted one
+        std::shared_mutex files;
+
+        // The most recently used entries are at the front
+        std::mutex mutex;
+        std::list<Entry> entries;
+        std::unordered_map<CacheKey, std::list<Entry>::iterator, KeyHash>
+            index;
+        size_t used = 0;
+
+        Utilities::BlockingQueue<Insert> inserts;
+        std::atomic<size_t> queued{0};    // The bytes of the queued inserts
+        std::thread appender;
+
+        std::atomic<size_t> hits{0};
+        std::atomic<size_t> misses{0};
+        std::atomic<size_t> evictions{0};
+
+        std::string path(const std::string& name) const;
+
+        /**
+         * @brief Index the entries of the pack, in the order of their last
+         * use in the previous runs
+         */
+        void load();
+
+        /**
+         * @brief Append the inserted entries to the pack (the thread of the
+         * appender). The entries that are already queued are written
+         * together
+         */
+        void append();
+
+        /**
+         * @brief Remove the least recently used entries from the index, until
+         * the entries fit in the capacity. The mutex must be locked
+         */
+        void evict();
+
+        /**
+         * @brief Whether the removed entries take more than the slack in the
+         * pack, so it should be compacted. The mutex must be locked
+         */
+        bool is_wasteful() const;
+
+        /**
+         * @brief Rewrite the pack with only the entries in the index, and
+         * use the new pack (the thread of the appender, or after it stopped)
+         * @return false if the pack could not be rewritten
+         */
+        bool compact();
+
+        /**
+         * @brief Save the order of the last use of the entries
+         */
+        void save_recency();
+
+       public:
+        /**
+         * @brief Open the cache, creating its directory if needed, and index
+         * the entries that already exist
+         * @param directory The directory of the cache
+         * @param capacity The maximum size of the entries, in bytes
+         * @param budget The memory budget the queued entries are charged to
+         */
+        ResultCache(const std::string& directory, size_t capacity,
+                    Utilities::MemoryBudget& budget);
+
+        ~ResultCache();
+
+        ResultCache(const ResultCache&) = delete;
+        ResultCache& operator=(const ResultCache&) = delete;
+
+        /**
+         * @brief Find a processed paragraph
+         * @param key The key of the paragraph
+         * @param data Where the processed paragraph is stored
+         * @return true if the paragraph was found
+         */
+        bool find(const CacheKey& key, std::string& data);
+
+        /**
+         * @brief Add a processed paragraph (if it isn't already there). It is
+         * written later, by the appender, and can be found after that. It is
+         * dropped if too many entries are queued, or the budget is used up
+         * @param key The key of the paragraph
+         * @param data The processed paragraph
+         */
+        void insert(const CacheKey& key, std::string_view data);
+
+        /**
+         * @brief Write the queued entries and close the cache, compacting the
+         * pack if needed. It must be called after the cache
+         * is no longer used (it is also called by the destructor)
+         */
+        void close();
+
+        /**
+         * @brief Print the number of hits and misses, and the size of the
+         * cache
+         */
+        void report(std::ostream& os);
+    };
+}    // namespace GenreParser
@@ -0,0 +1,260 @@
+/**
+ * @file Codec.cpp
+ * @author Grama Nicolae (gramanicu@gmail.com)
+ * @brief Message compression implementation
+ * @copyright Copyright (c) 2020
+ */
+
+#include "Codec.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "Helpers.hpp"
+#include "Trace.hpp"
+
+namespace GenreParser::Codec {
+    namespace {
+        const size_t HASH_BITS = 12;
+        const size_t MIN_MATCH = 4;
+        const size_t MAX_OFFSET = 65535;
+
+        // The format requires the last 5 bytes to be literals, and the last
+        // match to start at least 12 bytes before the end
+        const size_t LAST_LITERALS = 5;
+        const size_t MATCH_LIMIT = 12;
+
+        // In auto mode, a message is compressed at least once every this many
+        // messages
+        const size_t SAMPLE_INTERVAL = 32;
+
+        uint32_t read32(const char* data) {
+            uint32_t value;
+            std::memcpy(&value, data, sizeof(value));
+            return value;
+        }
+
+        size_t hash(uint32_t sequence) {
+            return (sequence * 2654435761u) >> (32 - HASH_BITS);
+        }
+
+        /**
+         * @brief Write the part of a length that doesn't fit in the token
+         */
+        char* write_length(char* out, size_t length) {
+            for (; length >= 255; length -= 255) { *out++ = (char)255; }
+            *out++ = (char)length;
+            return out;
+        }
+
+        /**
+         * @brief Read the part of a length that doesn't fit in the token
+         * @return false if the data ends before the length
+         */
+        bool read_length(const uint8_t*& in, const uint8_t* end,
+                         size_t& length) {
+            uint8_t byte;
+            do {
+                if (in == end) { return false; }
+                byte = *in++;
+                length += byte;
+            } while (byte == 255);
+            return true;
+        }
+
+        /**
+         * @brief Write a sequence: the token, the literals and, if it is not
+         * the last sequence, the match
+         */
+        char* write_sequence(char* out, const char* literals, size_t count,
+                             size_t offset, size_t match) {
+            char* token = out++;
+            *token = (char)(std::min<size_t>(count, 15) << 4);
+            if (count >= 15) { out = write_length(out, count - 15); }
+            std::memcpy(out, literals, count);
+            out += count;
+
+            if (match != 0) {
+                *out++ = (char)(offset & 0xFF);
+                *out++ = (char)(offset >> 8);
+
+                size_t length = match - MIN_MATCH;
+                *token |= (char)std::min<size_t>(length, 15);
+                if (length >= 15) { out = write_length(out, length - 15); }
+            }
+            return out;
+        }
+    }    // namespace
+
+    std::string to_string(Mode mode) {
+        switch (mode) {
+            case Mode::Off: {
+                return "off";
+            } break;
+            case Mode::On: {
+                return "on";
+            } break;
+            case Mode::Auto: {
+                return "auto";
+            } break;
+        }
+        return "";
+    }
+
+    bool from_string(std::string_view str, Mode& mode) {
+        for (auto m : {Mode::Off, Mode::On, Mode::Auto}) {
+            if (str == to_string(m)) {
+                mode = m;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    size_t compress(const char* data, size_t size, char* out) {
+        // The last position where each (hashed) sequence of 4 bytes was seen.
+        // The table is reused by the messages of a thread, without clearing
+        // it: an entry left by a previous message is only used if it is
+        // before the position and its bytes match, like any other candidate
+        thread_local std::vector<uint32_t> table(1 << HASH_BITS, 0);
+        char* start = out;
+        size_t position = 0, anchor = 0;
+
+        while (size >= MATCH_LIMIT && position + MATCH_LIMIT <= size) {
+            uint32_t sequence = read32(data + position);
+            uint32_t& entry = table[hash(sequence)];
+            size_t candidate = entry;
+            entry = position;
+
+            if (candidate >= position || position - candidate > MAX_OFFSET ||
+                read32(data + candidate) != sequence) {
+                ++position;
+                continue;
+            }
+
+            // Extend the match, but not in the last literals
+            size_t match = MIN_MATCH;
+            while (position + match < size - LAST_LITERALS &&
+                   data[candidate + match] == data[position + match]) {
+                ++match;
+            }
+
+            out = write_sequence(out, data + anchor, position - anchor,
+                                 position - candidate, match);
+            position += match;
+            anchor = position;
+        }
+
+        out = write_sequence(out, data + anchor, size - anchor, 0, 0);
+        return out - start;
+    }
+
+    bool decompress(const char* data, size_t size, char* out,
+                    size_t raw_size) {
+        const uint8_t* in = reinterpret_cast<const uint8_t*>(data);
+        const uint8_t* end = in + size;
+        size_t written = 0;
+
+        while (in < end) {
+            uint8_t token = *in++;
+
+            // The literals
+            size_t count = token >> 4;
+            if (count == 15 && !read_length(in, end, count)) { return false; }
+            if (count > (size_t)(end - in) || count > raw_size - written) {
+                return false;
+            }
+            std::memcpy(out + written, in, count);
+            in += count;
+            written += count;
+
+            // The last sequence has no match
+            if (in == end) { break; }
+
+            // The match, that can overlap the bytes it writes
+            if (end - in < 2) { return false; }
+            size_t offset = in[0] | (in[1] << 8);
+            in += 2;
+            size_t match = token & 15;
+            if (match == 15 && !read_length(in, end, match)) { return false; }
+            match += MIN_MATCH;
+            if (offset == 0 || offset > written ||
+                match > raw_size - written) {
+                return false;
+            }
+
+            for (size_t i = 0; i < match; ++i, ++written) {
+                out[written] = out[written - offset];
+            }
+        }
+
+        return written == raw_size;
+    }
+
+    std::string_view decode(const char* message, size_t size,
+                            std::vector<char>& buffer) {
+        Envelope envelope;
+        Conditions::MUST(size >= sizeof(envelope), "Codec: Invalid message\n");
+        std::memcpy(&envelope, message, sizeof(envelope));
+        message += sizeof(envelope);
+        size -= sizeof(envelope);
+
+        if (!(envelope.flags & COMPRESSED)) {
+            Conditions::MUST(size == envelope.raw_size,
+                             "Codec: Invalid message\n");
+            return std::string_view(message, size);
+        }
+
+        Trace::Scope scope("decompress", envelope.raw_size);
+        buffer.resize(envelope.raw_size);
+        Conditions::MUST(
+            decompress(message, size, buffer.data(), envelope.raw_size),
+            "Codec: Invalid compressed message\n");
+        return std::string_view(buffer.data(), buffer.size());
+    }
+
+    Encoder::Encoder(Mode mode, size_t threshold, double bandwidth)
+        : mode(mode), threshold(threshold), bandwidth(bandwidth) {}
+
+    bool Encoder::should_compress(size_t size) {
+        if (mode == Mode::Off || size < threshold) { return false; }
+        if (mode == Mode::On) { return true; }
+
+        if (speed == 0 || ++since_sample >= SAMPLE_INTERVAL) { return true; }
+        if (bandwidth == 0) { return false; }
+
+        double saved = size * (1 - ratio) / bandwidth;
+        double cost = size / speed;
+        return saved > cost;
+    }
+
+    bool Encoder::compress(const char* data, size_t size,
+                           std::vector<char>& wire) {
+        Trace::Scope scope("compress", size);
+        uint64_t start = Trace::now();
+
+        wire.resize(sizeof(Envelope) + max_compressed_size(size));
+        size_t compressed =
+            Codec::compress(data, size, wire.data() + sizeof(Envelope));
+
+        // Update the estimates
+        uint64_t time = std::max<uint64_t>(Trace::now() - start, 1);
+        double measured_speed = (double)size / time;
+        double measured_ratio = (double)compressed / size;
+        if (speed == 0) {
+            speed = measured_speed;
+            ratio = measured_ratio;
+        } else {
+            speed = (3 * speed + measured_speed) / 4;
+            ratio = (3 * ratio + measured_ratio) / 4;
+        }
+        since_sample = 0;
+
+        if (compressed >= size) { return false; }
+
+        Envelope envelope = make_envelope(COMPRESSED, size);
+        std::memcpy(wire.data(), &envelope, sizeof(envelope));
+        wire.resize(sizeof(Envelope) + compressed);
+        return true;
+    }
+}    // namespace GenreParser::Codec
@@ -0,0 +1,152 @@
+/**
+ * @file Codec.hpp
+ * @author Grama Nicolae (gramanicu@gmail.com)
+ * @brief Compression of the messages between the master and the workers
+ * @copyright Copyright (c) 2020
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Helpers.hpp"
+
+namespace GenreParser::Codec {
+    /**
+     * The messages are compressed in the LZ4 block format (a sequence of
+     * literals, each followed by a copy of a previous part of the data), with
+     * a self-contained implementation. When the compression is enabled,
+     * every message (except the eof one) starts with an Envelope, that tells
+     * if the rest of the message is compressed, so each message can be sent
+     * compressed or not
+     */
+    enum class Mode { Off, On, Auto };
+
+    std::string to_string(Mode mode);
+
+    /**
+     * @brief Find the mode that has the specified name
+     * @param str The name of the mode (off, on or auto)
+     * @param mode Where the mode will be stored
+     * @return true if the name is a valid mode, false otherwise
+     */
+    bool from_string(std::string_view str, Mode& mode);
+
+    struct Envelope {
+        uint32_t flags = 0;
+        uint32_t raw_size = 0;    // The size of the data, before compression
+    };
+
+    const uint32_t COMPRESSED = 1;
+
+    /**
+     * @brief The envelope of a message, checking that its size fits
+     * @param flags The flags of the message
+     * @param size The size of the data, before compression
+     */
+    inline Envelope make_envelope(uint32_t flags, size_t size) {
+        Conditions::MUST(size <= UINT32_MAX,
+                         "Codec: Message too large for its envelope\n");
+        return {flags, (uint32_t)size};
+    }
+
+    /**
+     * @brief The size of the envelope of the messages, or 0 if they don't
+     * have one
+     */
+    inline size_t envelope_size(Mode mode) {
+        return mode == Mode::Off ? 0 : sizeof(Envelope);
+    }
+
+    /**
+     * @brief The maximum size of some compressed data
+     * @param size The size of the data
+     */
+    inline size_t max_compressed_size(size_t size) {
+        return size + size / 255 + 16;
+    }
+
+    /**
+     * @brief Compress a block of data
+     * @param data The data
+     * @param size The size of the data
+     * @param out Where the compressed data is written, it must have
+     * max_compressed_size(size) bytes
+     * @return The size of the compressed data
+     */
+    size_t compress(const char* data, size_t size, char* out);
+
+    /**
+     * @brief Decompress a block of data
+     * @param data The compressed data
+     * @param size The size of the compressed data
+     * @param out Where the data is written, it must have raw_size bytes
+     * @param raw_size The size of the data, before compression
+     * @return false if the compressed data is invalid
+     */
+    bool decompress(const char* data, size_t size, char* out,
+                    size_t raw_size);
+
+    /**
+     * @brief The data of a received message (with an envelope), decompressed
+     * if needed
+     * @param message The message
+     * @param size The size of the message
+     * @param buffer Where the data is decompressed. It is reused between the
+     * messages
+     * @return The data, in the message or in the buffer
+     */
+    std::string_view decode(const char* message, size_t size,
+                            std::vector<char>& buffer);
+
+    /**
+     * @brief Compresses the messages sent on a link (by a single thread),
+     * and decides which ones are worth compressing. In auto mode, a message
+     * is compressed when the time it saves on the link is larger than the
+     * time it takes to compress it, from the bandwidth of the link and the
+     * measured speed and ratio of the compression. The decompression is
+     * several times faster than the compression, so it is not counted
+     */
+    class Encoder {
+       private:
+        Mode mode;
+        size_t threshold;
+        double bandwidth;    // Of the link, in bytes per nanosecond
+
+        // Measured on the compressed messages, as moving averages
+        double speed = 0;    // In bytes per nanosecond
+        double ratio = 1;
+        size_t since_sample = 0;
+
+       public:
+        /**
+         * @param mode The compression mode
+         * @param threshold Smaller messages are never compressed
+         * @param bandwidth The bandwidth of the link, in bytes per
+         * nanosecond (only used in auto mode)
+         */
+        Encoder(Mode mode, size_t threshold, double bandwidth = 0);
+
+        /**
+         * @brief Check if a message should be compressed. In auto mode, a
+         * message is compressed now and then even if it is not worth it, so
+         * the estimates follow the data
+         * @param size The size of the message
+         */
+        bool should_compress(size_t size);
+
+        /**
+         * @brief Compress a message, after its envelope
+         * @param data The message
+         * @param size The size of the message
+         * @param wire Where the envelope and the compressed message are
+         * written
+         * @return false if the compressed message is not smaller (then, it
+         * should be sent as it is)
+         */
+        bool compress(const char* data, size_t size, std::vector<char>& wire);
+    };
+}    // namespace GenreParser::Codec
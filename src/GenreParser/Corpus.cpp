@@ -0,0 +1,87 @@
+/**
+ * @file Corpus.cpp
+ * @author Grama Nicolae (gramanicu@gmail.com)
+ * @brief Corpus generator implementation
+ * @copyright Copyright (c) 2020
+ */
+
+#include "Corpus.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+#include "Genres.hpp"
+
+namespace GenreParser {
+    namespace {
+        // The letters appear about as often as in english text
+        const char LETTERS[] =
+            "eeeeeeeeeeeetttttttttaaaaaaaaooooooooiiiiiiinnnnnnnsssssshhhhhh"
+            "rrrrrrddddllllcccuuummmwwffggyyppbbvkjxqzTAISWHEOM,.";
+    }    // namespace
+
+    Corpus::Corpus(const CorpusShape& shape)
+        : shape(shape), state(shape.seed) {}
+
+    uint64_t Corpus::next() {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    size_t Corpus::around(size_t average) {
+        return average / 2 + next() % (average + 1);
+    }
+
+    std::string Corpus::line() {
+        std::string line;
+        size_t size = std::max<size_t>(1, around(shape.line_size));
+
+        while (line.size() < size) {
+            if (!line.empty()) { line.push_back(' '); }
+            size_t word = 1 + next() % 10;
+            for (size_t i = 0; i < word; ++i) {
+                line.push_back(LETTERS[next() % (sizeof(LETTERS) - 1)]);
+            }
+        }
+        return line;
+    }
+
+    Enums::GenresType Corpus::genre() {
+        // 53 bits, to get a uniform double in [0, 1)
+        double chance = (next() >> 11) * (1.0 / (1ull << 53));
+        if (chance < shape.skew) { return Enums::GenresType::Horror; }
+        return static_cast<Enums::GenresType>(next() %
+                                              Genres::Registry::count);
+    }
+
+    std::string Corpus::paragraph() {
+        std::string paragraph(Genres::header(genre()));
+        paragraph.push_back('\n');
+
+        size_t size = around(shape.paragraph_size);
+        do {
+            paragraph += line();
+            paragraph.push_back('\n');
+        } while (paragraph.size() < size);
+        return paragraph;
+    }
+
+    bool Corpus::write(const std::string& path) {
+        FILE* file = std::fopen(path.c_str(), "w");
+        if (file == nullptr) { return false; }
+
+        size_t written = 0;
+        while (written < shape.size) {
+            if (written != 0) {
+                std::fputc('\n', file);
+                written++;
+            }
+            std::string paragraph = this->paragraph();
+            std::fwrite(paragraph.data(), 1, paragraph.size(), file);
+            written += paragraph.size();
+        }
+        return std::fclose(file) == 0;
+    }
+}    // namespace GenreParser
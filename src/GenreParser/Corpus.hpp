@@ -0,0 +1,77 @@
+/**
+ * @file Corpus.hpp
+ * @author Grama Nicolae (gramanicu@gmail.com)
+ * @brief Deterministic generator of input files, used by the benchmarks
+ * @copyright Copyright (c) 2020
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "Helpers.hpp"
+
+namespace GenreParser {
+    /**
+     * @brief The shape of a generated corpus. The paragraph and line sizes
+     * are averages, the actual sizes are between half and 1.5 times them
+     */
+    struct CorpusShape {
+        size_t size = 32 << 20;
+        size_t paragraph_size = 4 << 10;
+        size_t line_size = 80;
+
+        // The fraction of the paragraphs that are horror, in addition to the
+        // uniform share of each genre (0 for uniform genres, 1 for horror only)
+        double skew = 0;
+        uint64_t seed = 1;
+    };
+
+    /**
+     * @brief Generates text with the same output on every platform (it
+     * doesn't use the standard distributions, that are implementation-defined)
+     */
+    class Corpus {
+       private:
+        CorpusShape shape;
+        uint64_t state;
+
+        /**
+         * @brief The next pseudo-random number (splitmix64)
+         */
+        uint64_t next();
+
+        /**
+         * @brief A random size between half and 1.5 times the average
+         */
+        size_t around(size_t average);
+
+       public:
+        explicit Corpus(const CorpusShape& shape);
+
+        /**
+         * @brief Generate a line (without the newline), of words separated by
+         * single spaces
+         */
+        std::string line();
+
+        /**
+         * @brief Choose the genre of the next paragraph
+         */
+        Enums::GenresType genre();
+
+        /**
+         * @brief Generate a paragraph, from its header to its last newline
+         */
+        std::string paragraph();
+
+        /**
+         * @brief Write the whole corpus, with the paragraphs separated by
+         * empty lines
+         * @param path The path of the file
+         * @return false if the file couldn't be written
+         */
+        bool write(const std::string& path);
+    };
+}    // namespace GenreParser
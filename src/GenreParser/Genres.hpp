@@ -0,0 +1,243 @@
+/**
+ * @file Genres.hpp
+ * @author Grama Nicolae (gramanicu@gmail.com)
+ * @brief Compile-time registry of the paragraph genres
+ * @copyright Copyright (c) 2020
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "Helpers.hpp"
+#include "Kernels.hpp"
+
+namespace GenreParser::Genres {
+    /**
+     * Each genre is a policy type, with its enum value, its header line and
+     * the transformation of a line. Adding a genre means adding its enum
+     * value, its policy and its entry in Registry
+     * The size of a transformed line is known before the transformation
+     * (output_size), so the lines can be transformed in place in the output
+     * buffer. The output buffer must have room for the line before its last
+     * space is removed (one more byte). Genres that expand the lines need a
+     * pass over the line to find its size
+     * A long line can be transformed in pieces, split before a space. Then,
+     * first_word is the index of the first word of the piece in the line
+     * The functions are templates of the kernels (Kernels::Scalar, SSE42 or
+     * AVX2) they use, so the loops over the lines call them directly
+     */
+
+    struct Horror {
+        static constexpr Enums::GenresType type = Enums::GenresType::Horror;
+        static constexpr std::string_view header = "horror";
+        static constexpr bool expands = true;
+
+        template <typename Set>
+        static size_t output_size(const char* line, size_t size) {
+            return Kernels::trim(line, size) +
+                   Set::count_consonants(line, size);
+        }
+
+        template <typename Set>
+        static size_t transform(const char* line, size_t size, char* out,
+                                [[maybe_unused]] size_t first_word) {
+            return Set::horror(line, size, out);
+        }
+    };
+
+    struct Comedy {
+        static constexpr Enums::GenresType type = Enums::GenresType::Comedy;
+        static constexpr std::string_view header = "comedy";
+        static constexpr bool expands = false;
+
+        template <typename Set>
+        static size_t output_size(const char* line, size_t size) {
+            return Kernels::trim(line, size);
+        }
+
+        template <typename Set>
+        static size_t transform(const char* line, size_t size, char* out,
+                                [[maybe_unused]] size_t first_word) {
+            std::memcpy(out, line, size);
+            return Set::comedy(out, size);
+        }
+    };
+
+    struct Fantasy {
+        static constexpr Enums::GenresType type = Enums::GenresType::Fantasy;
+        static constexpr std::string_view header = "fantasy";
+        static constexpr bool expands = false;
+
+        template <typename Set>
+        static size_t output_size(const char* line, size_t size) {
+            return Kernels::trim(line, size);
+        }
+
+        template <typename Set>
+        static size_t transform(const char* line, size_t size, char* out,
+                                [[maybe_unused]] size_t first_word) {
+            std::memcpy(out, line, size);
+            return Set::fantasy(out, size);
+        }
+    };
+
+    struct SciFi {
+        static constexpr Enums::GenresType type = Enums::GenresType::SciFi;
+        static constexpr std::string_view header = "science-fiction";
+        static constexpr bool expands = false;
+
+        template <typename Set>
+        static size_t output_size(const char* line, size_t size) {
+            return Kernels::trim(line, size);
+        }
+
+        template <typename Set>
+        static size_t transform(const char* line, size_t size, char* out,
+                                size_t first_word) {
+            std::memcpy(out, line, size);
+            return Kernels::scifi(out, size, first_word);
+        }
+    };
+
+    /**
+     * @brief A list of genres, in the order of their enum values
+     */
+    template <typename... Genre>
+    struct List {
+        static constexpr size_t count = sizeof...(Genre);
+        static constexpr std::array<std::string_view, count> headers = {
+            Genre::header...};
+
+        static constexpr bool is_ordered() {
+            size_t index = 0;
+            return ((static_cast<size_t>(Genre::type) == index++) && ...);
+        }
+
+        /**
+         * @brief Call a function with the policy of a genre, so the function
+         * is instantiated (and specialized) once for each genre
+         * @param type The genre
+         * @param function The function, that takes the policy as argument
+         */
+        template <typename Function>
+        static void visit(Enums::GenresType type, Function&& function) {
+            (void)((type == Genre::type ? (function(Genre{}), true) : false) ||
+                   ...);
+        }
+    };
+
+    using Registry = List<Horror, Comedy, Fantasy, SciFi>;
+    static_assert(Registry::is_ordered(),
+                  "The genres must be in the order of their enum values");
+
+    /**
+     * Perfect hash of the headers: the seed of the hash is chosen at compile
+     * time, so that every header has its own slot in the table
+     */
+    namespace Hash {
+        constexpr size_t BITS = 3;
+        constexpr size_t SLOTS = 1 << BITS;
+        constexpr uint8_t EMPTY = 0xFF;
+        static_assert(Registry::count * 2 <= SLOTS, "Too many genres");
+
+        /**
+         * @brief Seeded FNV-1a hash of a string, reduced to a slot
+         */
+        constexpr size_t slot(std::string_view str, uint32_t seed) {
+            uint32_t hash = 2166136261u ^ seed;
+            for (char c : str) { hash = (hash ^ (uint8_t)c) * 16777619u; }
+            return hash >> (32 - BITS);
+        }
+
+        constexpr bool is_perfect(uint32_t seed) {
+            std::array<bool, SLOTS> used{};
+            for (auto header : Registry::headers) {
+                size_t index = slot(header, seed);
+                if (used[index]) { return false; }
+                used[index] = true;
+            }
+            return true;
+        }
+
+        constexpr uint32_t find_seed() {
+            uint32_t seed = 0;
+            while (!is_perfect(seed)) { ++seed; }
+            return seed;
+        }
+
+        constexpr uint32_t SEED = find_seed();
+
+        constexpr std::array<uint8_t, SLOTS> make_table() {
+            std::array<uint8_t, SLOTS> table{};
+            for (auto& entry : table) { entry = EMPTY; }
+            for (size_t i = 0; i < Registry::count; ++i) {
+                table[slot(Registry::headers[i], SEED)] = i;
+            }
+            return table;
+        }
+
+        constexpr std::array<uint8_t, SLOTS> TABLE = make_table();
+    }    // namespace Hash
+
+    /**
+     * @brief The header line of a genre
+     */
+    constexpr std::string_view header(Enums::GenresType type) {
+        return Registry::headers[static_cast<size_t>(type)];
+    }
+
+    /**
+     * @brief The size of some lines of a paragraph, after they are processed:
+     * the empty lines are removed, and each of the others ends with a newline
+     * @param type The genre of the paragraph
+     * @param lines The lines, without the header line
+     * @param size The size of the lines
+     */
+    inline size_t output_size(Enums::GenresType type, const char* lines,
+                              size_t size) {
+        size_t total = 0;
+        Kernels::visit(Kernels::selected(), [&](auto set) {
+            using Set = decltype(set);
+
+            Registry::visit(type, [&](auto genre) {
+                using Genre = decltype(genre);
+
+                const char* end = lines + size;
+                for (const char* line = lines; line < end;) {
+                    const char* newline =
+                        (const char*)std::memchr(line, '\n', end - line);
+                    const char* stop = newline != nullptr ? newline : end;
+                    if (stop != line) {
+                        total += Genre::template output_size<Set>(
+                                     line, stop - line) +
+                                 1;
+                    }
+                    line = stop + 1;
+                }
+            });
+        });
+        return total;
+    }
+
+    /**
+     * @brief Find the genre that has the specified header, with a single
+     * comparison
+     * @param str The header line
+     * @param type Where the genre will be stored
+     * @return true if the line is a valid header, false otherwise
+     */
+    constexpr bool find(std::string_view str, Enums::GenresType& type) {
+        uint8_t index = Hash::TABLE[Hash::slot(str, Hash::SEED)];
+        if (index == Hash::EMPTY || Registry::headers[index] != str) {
+            return false;
+        }
+        type = static_cast<Enums::GenresType>(index);
+        return true;
+    }
+}    // namespace GenreParser::Genres
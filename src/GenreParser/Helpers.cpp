@@ -7,24 +7,12 @@
 
 #include "Helpers.hpp"
 
+#include "Genres.hpp"
+
 namespace GenreParser {
     namespace Enums {
         std::string to_string(const GenresType& gt) {
-            switch (gt) {
-                case GenresType::Horror: {
-                    return "horror";
-                } break;
-                case GenresType::Comedy: {
-                    return "comedy";
-                } break;
-                case GenresType::Fantasy: {
-                    return "fantasy";
-                } break;
-                case GenresType::SciFi: {
-                    return "science-fiction";
-                } break;
-            }
-            return "";
+            return std::string(Genres::header(gt));
         }
 
         std::string to_string(const NodesType& nt) {
@@ -32,38 +20,19 @@ namespace GenreParser {
                 case NodesType::Master: {
                     return "Master";
                 } break;
-                case NodesType::Horror: {
-                    return "Horror";
-                } break;
-                case NodesType::Comedy: {
-                    return "Comedy";
-                } break;
-                case NodesType::Fantasy: {
-                    return "Fantasy";
-                } break;
-                case NodesType::SciFi: {
-                    return "SciFi";
+                case NodesType::Worker: {
+                    return "Worker";
                 } break;
             }
             return "";
         }
 
+        bool from_string(std::string_view str, GenresType& gt) {
+            return Genres::find(str, gt);
+        }
+
         std::ostream& operator<<(std::ostream& os, const GenresType& gt) {
-            switch (gt) {
-                case GenresType::Horror: {
-                    os << "horror";
-                } break;
-                case GenresType::Comedy: {
-                    os << "comedy";
-                } break;
-                case GenresType::Fantasy: {
-                    os << "fantasy";
-                } break;
-                case GenresType::SciFi: {
-                    os << "science-fiction";
-                } break;
-            }
-            return os;
+            return os << Genres::header(gt);
         }
 
         std::ostream& operator<<(std::ostream& os, const NodesType& nt) {
@@ -71,17 +40,8 @@ namespace GenreParser {
                 case NodesType::Master: {
                     os << "Master";
                 } break;
-                case NodesType::Horror: {
-                    os << "Horror";
-                } break;
-                case NodesType::Comedy: {
-                    os << "Comedy";
-                } break;
-                case NodesType::Fantasy: {
-                    os << "Fantasy";
-                } break;
-                case NodesType::SciFi: {
-                    os << "SciFi";
+                case NodesType::Worker: {
+                    os << "Worker";
                 } break;
             }
             return os;
@@ -7,27 +7,79 @@
 
 #pragma once
 
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
 #include <sstream>
+#include <string>
+#include <string_view>
 
 namespace GenreParser::Constants {
     const int MASTER = 0;
-    const int WORKERS = 4;
-    const int MASTER_THREADS = WORKERS;
-    const int LINES_PER_THREAD = 20;
+    const size_t READ_BUFFER_SIZE = 1 << 20;
+    const size_t WRITE_BUFFER_SIZE = 4 << 20;
+    const int DEFAULT_WINDOW = 8;
+    const int MAX_TAG = 32767;    // The minimum MPI_TAG_UB
+    const int DEFAULT_BATCH_COUNT = 64;
+    const long DEFAULT_BATCH_BYTES = 1 << 16;
+    const long DEFAULT_SPLIT_BYTES = 1 << 20;
+
+    // A message has 32 bit offsets and an int count. A batch holds less than
+    // batch_bytes plus one paragraph, and its reply is at most twice as
+    // large, so with these limits every message stays under 1GB
+    const long MAX_BATCH_BYTES = 128 << 20;
+    const size_t MAX_PARAGRAPH_BYTES = 256 << 20;
+    const int MAX_BATCH_COUNT = 1 << 20;
+    const size_t MAX_TRACE_EVENTS = 1 << 20;    // For each thread
+    const int TRACE_TAG = MAX_TAG;    // Not used by the batches
+    const size_t TRACE_CHUNK = 1 << 30;    // Fits in the int count of MPI
+    const size_t DEFAULT_TASK_BYTES = 16 << 10;
+    const size_t MIN_TASK_BYTES = 512;
+    const size_t MAX_TASK_BYTES = 4 << 20;
+    const long DEFAULT_TASK_TIME = 100;    // In microseconds
+    const int DEFAULT_BUFFERS = 2;
+    const long PROGRESS_INTERVAL = 50;    // In microseconds
+    const long DEFAULT_COMPRESS_THRESHOLD = 4 << 10;
+    const size_t BANDWIDTH_PROBE_BYTES = 1 << 20;
+    const int BANDWIDTH_PROBES = 4;
+    const int DEFAULT_OPEN_FILES = 16;
+    const long DEFAULT_CACHE_SIZE = 256 << 20;
+    const size_t MIN_SCAN_BYTES = 16 << 20;    // For each scanning thread
 }    // namespace GenreParser::Constants
 
 namespace GenreParser::Enums {
     enum class GenresType { Horror, Comedy, Fantasy, SciFi };
-    enum class NodesType { Master, Horror, Comedy, Fantasy, SciFi };
+    enum class NodesType { Master, Worker };
 
     std::string to_string(const GenresType& gt);
     std::string to_string(const NodesType& nt);
+
+    /**
+     * @brief Find the genre that has the specified name
+     * @param str The name of the genre (a paragraph header)
+     * @param gt Where the genre will be stored
+     * @return true if the name is a valid genre, false otherwise
+     */
+    bool from_string(std::string_view str, GenresType& gt);
     std::ostream& operator<<(std::ostream& os, const GenresType& gt);
     std::ostream& operator<<(std::ostream& os, const NodesType& nt);
 }    // namespace GenreParser::Enums
 
 namespace GenreParser::Conditions {
+    /**
+     * @brief Print the error message and exit the program. The static objects
+     * are not destroyed, as the error can happen on any thread, while the
+     * other ones still wait on the queues
+     * @param error The error message
+     * @param code The exit code
+     */
+    [[noreturn]] inline void fail(const std::string& error, int code) {
+        std::cerr << error;
+        std::cout.flush();
+        std::fflush(nullptr);
+        std::_Exit(code);
+    }
+
     /**
      * @brief Check if the condition is triggered. If it is not, print the
      * error message and exit the program
@@ -36,10 +88,7 @@ namespace GenreParser::Conditions {
      * @param code The exit code
      */
     inline void MUST(bool condition, std::string error, int code = -1) {
-        if (!condition) {
-            std::cerr << error;
-            exit(code);
-        }
+        if (!condition) { fail(error, code); }
     }
 
     /**
@@ -50,22 +99,31 @@ namespace GenreParser::Conditions {
      * @param code The exit code
      */
     inline void MUST_NOT(bool condition, std::string error, int code = -1) {
-        if (condition) {
-            std::cerr << error;
-            exit(code);
-        }
+        if (condition) { fail(error, code); }
     }
 }    // namespace GenreParser::Conditions
 
 namespace GenreParser::Utilities {
+    /**
+     * The text is ASCII, so the characters are classified without the
+     * locale-dependent isalpha / tolower / toupper. Other bytes are never
+     * letters
+     */
     inline bool is_vowel(char c) {
-        if (!isalpha(c)) return false;
-        c = std::tolower(c);
+        c |= 0x20;
         return (c == 'a' || c == 'e' || c == 'i' || c == 'o' || c == 'u');
     }
 
     inline bool is_consonant(char c) {
-        if (!isalpha(c)) return false;
-        return !is_vowel(c);
+        char lower = c | 0x20;
+        return lower >= 'a' && lower <= 'z' && !is_vowel(c);
+    }
+
+    inline char to_upper(char c) {
+        return (c >= 'a' && c <= 'z') ? c - 'a' + 'A' : c;
+    }
+
+    inline char to_lower(char c) {
+        return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
     }
-}    // namespace GenreParser::Utilities
\ No newline at end of file
+}    // namespace GenreParser::Utilities
@@ -0,0 +1,333 @@
+/**
+ * @file InputFile.cpp
+ * @author Grama Nicolae (gramanicu@gmail.com)
+ * @brief Input file reader implementation
+ * @copyright Copyright (c) 2020
+ */
+
+#include "InputFile.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <thread>
+
+namespace GenreParser {
+    namespace {
+        const size_t NONE = SIZE_MAX;
+
+        /**
+         * @brief The paragraphs found in a range of lines. The lines before
+         * the first empty line of the range can continue a paragraph of the
+         * range before it, so only their first header line is kept. After
+         * the empty line, the paragraphs are found as usual
+         */
+        struct RangeScan {
+            size_t first_empty = NONE;
+            size_t first_header = NONE;
+            Enums::GenresType first_type;
+            std::vector<ParagraphEntry> paragraphs;
+
+            // The paragraph that continues in the next range
+            size_t open = NONE;
+            Enums::GenresType open_type;
+        };
+
+        /**
+         * @brief Find the paragraphs in a range of lines of the file
+         * @param data The file
+         * @param begin The start of the range, at the start of a line
+         * @param end The end of the range, at the start of a line (or at the
+         * end of the file)
+         * @param scan Where the paragraphs are stored
+         */
+        void scan_range(const char* data, size_t begin, size_t end,
+                        RangeScan& scan) {
+            for (size_t line = begin; line < end;) {
+                const char* newline =
+                    (const char*)std::memchr(data + line, '\n', end - line);
+                size_t stop = newline != nullptr ? newline - data : end;
+                std::string_view text(data + line, stop - line);
+                Enums::GenresType type;
+
+                if (scan.first_empty == NONE) {
+                    if (text.empty()) {
+                        scan.first_empty = line;
+                    } else if (scan.first_header == NONE &&
+                               Enums::from_string(text, type)) {
+                        scan.first_header = line;
+                        scan.first_type = type;
+                    }
+                } else if (scan.open == NONE) {
+                    if (Enums::from_string(text, type)) {
+                        scan.open = line;
+                        scan.open_type = type;
+                    }
+                } else if (text.empty()) {
+                    scan.paragraphs.push_back(
+                        {scan.open, line - scan.open, scan.open_type});
+                    scan.open = NONE;
+                }
+                line = stop + 1;
+            }
+        }
+    }    // namespace
+
+    InputFile::InputFile(const std::string& path) {
+        fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) { return; }
+
+        struct stat info;
+        if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode)) {
+            map_size = info.st_size;
+            end = map_size;
+
+            if (map_size == 0) {
+                mapped = true;
+                return;
+            }
+
+            void* addr = mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr != MAP_FAILED) {
+                madvise(addr, map_size, MADV_SEQUENTIAL);
+                map = static_cast<const char*>(addr);
+                mapped = true;
+                return;
+            }
+        }
+
+        // Not a regular file, fall back to buffered reads
+        map_size = 0;
+        end = 0;
+        buffer.resize(Constants::READ_BUFFER_SIZE);
+    }
+
+    InputFile::~InputFile() {
+        if (map != nullptr) { munmap((void*)map, map_size); }
+        if (fd >= 0) { close(fd); }
+    }
+
+    bool InputFile::is_open() const { return fd >= 0; }
+
+    bool InputFile::fill_buffer() {
+        if (eof) { return false; }
+
+        // Move the unprocessed data at the start of the buffer
+        if (begin != 0) {
+            std::memmove(buffer.data(), buffer.data() + begin, end - begin);
+            end -= begin;
+            begin = 0;
+        }
+        if (end == buffer.size()) { buffer.resize(buffer.size() * 2); }
+
+        ssize_t count = read(fd, buffer.data() + end, buffer.size() - end);
+        if (count <= 0) {
+            eof = true;
+            return false;
+        }
+        end += count;
+        return true;
+    }
+
+    bool InputFile::next_line(std::string_view& line) {
+        while (true) {
+            const char* data = mapped ? map : buffer.data();
+            const char* newline =
+                begin == end ? nullptr
+                             : (const char*)std::memchr(data + begin, '\n',
+                                                        end - begin);
+
+            if (newline != nullptr) {
+                line = std::string_view(data + begin, newline - (data + begin));
+                begin = newline - data + 1;
+                return true;
+            }
+            if (mapped || !fill_buffer()) { break; }
+        }
+
+        // The last line of the file, without a newline
+        if (begin == end) { return false; }
+        const char* data = mapped ? map : buffer.data();
+        line = std::string_view(data + begin, end - begin);
+        begin = end;
+        return true;
+    }
+
+    void InputFile::index(size_t threads) {
+        size_t count = std::min(threads, map_size / Constants::MIN_SCAN_BYTES);
+        if (!mapped || indexed || count < 2) { return; }
+
+        // Ranges of about the same size, that start at the start of a line
+        std::vector<size_t> bounds(count + 1, map_size);
+        bounds[0] = 0;
+        for (size_t i = 1; i < count; ++i) {
+            size_t start = std::max(map_size / count * i, bounds[i - 1]);
+            if (start != 0 && map[start - 1] != '\n') {
+                const char* newline = (const char*)std::memchr(
+                    map + start, '\n', map_size - start);
+                start = newline != nullptr ? newline - map + 1 : map_size;
+            }
+            bounds[i] = start;
+        }
+
+        std::vector<RangeScan> scans(count);
+        std::vector<std::thread> scanners;
+        for (size_t i = 1; i < count; ++i) {
+            scanners.emplace_back(scan_range, map, bounds[i], bounds[i + 1],
+                                  std::ref(scans[i]));
+        }
+        scan_range(map, bounds[0], bounds[1], scans[0]);
+        for (auto& scanner : scanners) { scanner.join(); }
+
+        // Join the ranges. A paragraph left open by a range ends at the first
+        // empty line of one of the next ranges (or at the end of the file)
+        size_t total = 0;
+        for (auto& scan : scans) { total += scan.paragraphs.size() + 1; }
+        paragraphs.reserve(total);
+
+        size_t open = NONE;
+        Enums::GenresType open_type;
+        for (auto& scan : scans) {
+            if (open == NONE && scan.first_header != NONE) {
+                open = scan.first_header;
+                open_type = scan.first_type;
+            }
+            if (scan.first_empty == NONE) { continue; }
+
+            if (open != NONE) {
+                paragraphs.push_back(
+                    {open, scan.first_empty - open, open_type});
+            }
+            paragraphs.insert(paragraphs.end(), scan.paragraphs.begin(),
+                              scan.paragraphs.end());
+            open = scan.open;
+            open_type = scan.open_type;
+        }
+        if (open != NONE) {
+            paragraphs.push_back({open, map_size - open, open_type});
+        }
+
+        indexed = true;
+        begin = end;
+    }
+
+    bool InputFile::next(Paragraph& paragraph) {
+        if (indexed) {
+            if (next_paragraph == paragraphs.size()) { return false; }
+            const ParagraphEntry& entry = paragraphs[next_paragraph++];
+            paragraph.type = entry.type;
+            paragraph.data = map + entry.offset;
+            paragraph.size = entry.size;
+            paragraph.storage.clear();
+            return true;
+        }
+
+        std::string_view line;
+
+        // Find the header of the next paragraph
+        while (true) {
+            if (!next_line(line)) { return false; }
+            if (Enums::from_string(line, paragraph.type)) { break; }
+        }
+
+        if (mapped) {
+            // The paragraph is the mapped data up to the empty line
+            const char* start = line.data();
+            const char* stop = line.data() + line.size();
+            while (next_line(line) && !line.empty()) {
+                stop = line.data() + line.size();
+            }
+
+            // Include the newline of the last line, if there is one
+            if (stop != map + map_size) { ++stop; }
+
+            paragraph.data = start;
+            paragraph.size = stop - start;
+            paragraph.storage.clear();
+        } else {
+            // The lines are only valid until the next read, so copy them
+            paragraph.storage.clear();
+            do {
+                paragraph.storage.insert(paragraph.storage.end(), line.begin(),
+                                         line.end());
+                paragraph.storage.push_back('\n');
+            } while (next_line(line) && !line.empty());
+
+            paragraph.data = paragraph.storage.data();
+            paragraph.size = paragraph.storage.size();
+        }
+
+        return true;
+    }
+
+    std::vector<Paragraph> InputFile::split(Paragraph paragraph,
+                                            size_t max_size) const {
+        std::vector<Paragraph> parts;
+        const char* first = paragraph.data;
+        const char* last = paragraph.data + paragraph.size;
+        const char* lines =
+            (const char*)std::memchr(first, '\n', paragraph.size);
+
+        if (lines == nullptr || (size_t)(last - ++lines) <= max_size) {
+            parts.push_back(std::move(paragraph));
+            return parts;
+        }
+
+        std::string_view header(first, lines - first);
+        size_t count = (last - lines + max_size - 1) / max_size;
+        size_t target = (last - lines + count - 1) / count;
+
+        for (const char* start = lines; start != last;) {
+            // End the part after the line that reaches the target size
+            const char* stop = start + std::min(target, (size_t)(last - start));
+            if (stop != last) {
+                stop = (const char*)std::memchr(stop - 1, '\n',
+                                                last - stop + 1);
+                stop = stop == nullptr ? last : stop + 1;
+            }
+
+            Paragraph part;
+            part.type = paragraph.type;
+            part.file = paragraph.file;
+            part.sequence = paragraph.sequence;
+            part.part = parts.size();
+            if (paragraph.storage.empty()) {
+                part.header = header;
+                part.data = start;
+                part.size = stop - start;
+            } else {
+                // The paragraph storage is freed, so the part needs its own
+                part.storage.assign(header.begin(), header.end());
+                part.storage.insert(part.storage.end(), start, stop);
+                part.data = part.storage.data();
+                part.size = part.storage.size();
+            }
+            parts.push_back(std::move(part));
+            start = stop;
+        }
+
+        for (auto& part : parts) { part.parts = parts.size(); }
+        return parts;
+    }
+
+    void InputFile::release(const Paragraph& paragraph) const {
+        if (!mapped || paragraph.size == 0) { return; }
+
+        // Only the pages that are fully covered by the paragraph
+        uintptr_t page = sysconf(_SC_PAGESIZE);
+        uintptr_t start = (uintptr_t)paragraph.data;
+        uintptr_t stop = start + paragraph.size;
+        start = (start + page - 1) / page * page;
+        stop = stop / page * page;
+
+        if (start < stop) {
+            madvise((void*)start, stop - start, MADV_DONTNEED);
+        }
+    }
+}    // namespace GenreParser
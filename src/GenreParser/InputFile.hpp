@@ -0,0 +1,138 @@
+/**
+ * @file InputFile.hpp
+ * @author Grama Nicolae (gramanicu@gmail.com)
+ * @brief Input file reader, that splits the file into paragraphs
+ * @copyright Copyright (c) 2020
+ */
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Helpers.hpp"
+
+namespace GenreParser {
+    /**
+     * @brief A paragraph from the input file, starting with its header line.
+     * The data either points inside the memory-mapped file, or in the
+     * storage of the paragraph (when the file couldn't be mapped)
+     * A part of a split paragraph has only some of its lines. The header line
+     * is kept separately, if it isn't in the storage
+     */
+    struct Paragraph {
+        Enums::GenresType type;
+        size_t file = 0;    // The index of the input file
+        size_t sequence;    // The position of the paragraph in the file
+        size_t part = 0;
+        size_t parts = 1;
+        std::string_view header;
+        const char* data = nullptr;
+        size_t size = 0;
+        std::vector<char> storage;
+
+        // Where the processed paragraph is written, and its size (only
+        // computed when the paragraphs are written at their offsets)
+        size_t output_offset = 0;
+        size_t output_size = 0;
+    };
+
+    /**
+     * @brief The position of a paragraph in a mapped file. The entries of the
+     * index are in the order of the file, so the position of an entry is the
+     * sequence of its paragraph
+     */
+    struct ParagraphEntry {
+        size_t offset;
+        size_t size;
+        Enums::GenresType type;
+    };
+
+    class InputFile {
+       private:
+        int fd = -1;
+        bool mapped = false;
+        bool eof = false;
+
+        // The paragraphs of the file, if it was indexed, and the next one
+        bool indexed = false;
+        std::vector<ParagraphEntry> paragraphs;
+        size_t next_paragraph = 0;
+
+        // The file contents (memory-mapped), or the read buffer
+        const char* map = nullptr;
+        size_t map_size = 0;
+        std::vector<char> buffer;
+
+        // The unprocessed part of the data
+        size_t begin = 0;
+        size_t end = 0;
+
+        /**
+         * @brief Get the next line of the file, without the newline. In
+         * buffered mode, the line is valid until the next call
+         * @param line Where the line will be stored
+         * @return false if the end of the file was reached
+         */
+        bool next_line(std::string_view& line);
+
+        /**
+         * @brief Read more data in the buffer (only in buffered mode)
+         * @return false if no data could be read
+         */
+        bool fill_buffer();
+
+       public:
+        /**
+         * @brief Open the file. Regular files are memory-mapped, the other
+         * ones (pipes, devices) are read through a buffer
+         * @param path The path of the file
+         */
+        explicit InputFile(const std::string& path);
+        ~InputFile();
+
+        InputFile(const InputFile&) = delete;
+        InputFile& operator=(const InputFile&) = delete;
+
+        bool is_open() const;
+
+        /**
+         * @brief Find all the paragraphs of a mapped file at once, by
+         * scanning ranges of the file in parallel. After this, next() takes
+         * the paragraphs from the index. Files that are not mapped, or that
+         * are too small to be worth it, are still scanned a line at a time,
+         * by next()
+         * @param threads The maximum number of threads that scan the file
+         */
+        void index(size_t threads);
+
+        /**
+         * @brief Get the next valid paragraph, ignoring the lines outside of
+         * paragraphs. A paragraph ends with an empty line, or with the file
+         * @param paragraph Where the paragraph will be stored
+         * @return false if there are no more paragraphs
+         */
+        bool next(Paragraph& paragraph);
+
+        /**
+         * @brief Split a paragraph into parts of about the same size, of at
+         * most max_size bytes (unless a line is larger), between lines. Each
+         * part can be processed on its own, as it has the header line
+         * @param paragraph The paragraph
+         * @param max_size The maximum size of a part
+         * @return The parts of the paragraph, or only the paragraph, if it is
+         * small enough
+         */
+        std::vector<Paragraph> split(Paragraph paragraph,
+                                     size_t max_size) const;
+
+        /**
+         * @brief Let the system reclaim the memory of a paragraph that is no
+         * longer needed (only for mapped files). If the pages are accessed
+         * again, they are read from the file
+         * @param paragraph The paragraph
+         */
+        void release(const Paragraph& paragraph) const;
+    };
+}    // namespace GenreParser
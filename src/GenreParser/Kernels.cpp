@@ -0,0 +1,300 @@
+/**
+ * @file Kernels.cpp
+ * @author Grama Nicolae (gramanicu@gmail.com)
+ * @brief Scalar line transformations, and the choice of the instruction set
+ * @copyright Copyright (c) 2020
+ */
+
+#include "Kernels.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <sstream>
+#include <vector>
+
+#include "Helpers.hpp"
+
+namespace GenreParser::Kernels {
+    namespace {
+        struct Implementation {
+            Level level;
+            size_t (*count_consonants)(const char*, size_t);
+            size_t (*horror)(const char*, size_t, char*);
+            size_t (*comedy)(char*, size_t);
+            size_t (*fantasy)(char*, size_t);
+        };
+
+        const Implementation implementations[] = {
+            {Level::Scalar, Scalar::count_consonants, Scalar::horror,
+             Scalar::comedy, Scalar::fantasy},
+            {Level::SSE42, SSE42::count_consonants, SSE42::horror,
+             SSE42::comedy, SSE42::fantasy},
+            {Level::AVX2, AVX2::count_consonants, AVX2::horror, AVX2::comedy,
+             AVX2::fantasy},
+        };
+
+        const Implementation* active = &implementations[(int)detect()];
+
+        /**
+         * The transformations as they were first written: word by word, with
+         * the C library character functions. They are slow, but they are
+         * kept as the reference the kernels are checked against
+         */
+        namespace Reference {
+            bool is_vowel(char c) {
+                if (!std::isalpha((unsigned char)c)) { return false; }
+                c = std::tolower((unsigned char)c);
+                return (c == 'a' || c == 'e' || c == 'i' || c == 'o' ||
+                        c == 'u');
+            }
+
+            bool is_consonant(char c) {
+                if (!std::isalpha((unsigned char)c)) { return false; }
+                return !is_vowel(c);
+            }
+
+            /**
+             * @brief Transform each word of a line, and join the words back
+             * (without a space at the end)
+             */
+            template <typename Function>
+            std::string transform(const std::string& text,
+                                  Function&& function) {
+                std::stringstream line(text);
+                std::string word;
+                std::string result = "";
+                int word_counter = 0;
+
+                while (std::getline(line, word, ' ')) {
+                    result += function(word, ++word_counter) + " ";
+                }
+
+                if (!result.empty()) { result.pop_back(); }
+                return result;
+            }
+
+            std::string horror(const std::string& text) {
+                return transform(text, [](const std::string& word, int) {
+                    std::string result = "";
+                    for (char c : word) {
+                        result += c;
+                        if (is_consonant(c)) {
+                            result += std::tolower((unsigned char)c);
+                        }
+                    }
+                    return result;
+                });
+            }
+
+            std::string comedy(const std::string& text) {
+                return transform(text, [](std::string word, int) {
+                    for (size_t i = 1; i < word.size(); i += 2) {
+                        word[i] = std::toupper((unsigned char)word[i]);
+                    }
+                    return word;
+                });
+            }
+
+            std::string fantasy(const std::string& text) {
+                return transform(text, [](std::string word, int) {
+                    if (!word.empty()) {
+                        word[0] = std::toupper((unsigned char)word[0]);
+                    }
+                    return word;
+                });
+            }
+
+            std::string scifi(const std::string& text) {
+                return transform(text, [](std::string word, int index) {
+                    if (index % 7 == 0) {
+                        std::reverse(word.begin(), word.end());
+                    }
+                    return word;
+                });
+            }
+        }    // namespace Reference
+
+        /**
+         * @brief Check the result of a kernel against the reference
+         */
+        bool matches(const std::string& expected, const char* actual,
+                     size_t actual_size) {
+            return expected.size() == actual_size &&
+                   std::equal(expected.begin(), expected.end(), actual);
+        }
+    }    // namespace
+
+    size_t Scalar::count_consonants(const char* line, size_t size) {
+        size_t count = 0;
+        for (size_t i = 0; i < size; ++i) {
+            count += Utilities::is_consonant(line[i]);
+        }
+        return count;
+    }
+
+    size_t Scalar::horror(const char* line, size_t size, char* out) {
+        size_t out_size = size + count_consonants(line, size);
+
+        // Write from the end, so the line can be expanded in place
+        size_t pos = out_size;
+        for (size_t i = size; i-- > 0;) {
+            char c = line[i];
+            if (Utilities::is_consonant(c)) {
+                out[--pos] = Utilities::to_lower(c);
+            }
+            out[--pos] = c;
+        }
+
+        return trim(out, out_size);
+    }
+
+    size_t Scalar::comedy(char* line, size_t size) {
+        size_t position = 0;
+        for (size_t i = 0; i < size; ++i) {
+            if (line[i] == ' ') {
+                position = 0;
+                continue;
+            }
+            if (position & 1) { line[i] = Utilities::to_upper(line[i]); }
+            position++;
+        }
+
+        return trim(line, size);
+    }
+
+    size_t Scalar::fantasy(char* line, size_t size) {
+        bool word_start = true;
+        for (size_t i = 0; i < size; ++i) {
+            if (word_start) { line[i] = Utilities::to_upper(line[i]); }
+            word_start = line[i] == ' ';
+        }
+
+        return trim(line, size);
+    }
+
+    size_t scifi(char* line, size_t size, size_t first_word) {
+        char* end = line + size;
+        int word_counter = first_word % 7;
+
+        for (char* word = line; word < end;) {
+            char* space = (char*)std::memchr(word, ' ', end - word);
+            char* word_end = space != nullptr ? space : end;
+
+            word_counter++;
+            if (word_counter == 7) {
+                word_counter = 0;
+                std::reverse(word, word_end);
+            }
+
+            word = word_end + 1;
+        }
+
+        return trim(line, size);
+    }
+
+    std::string to_string(Level level) {
+        switch (level) {
+            case Level::Scalar: {
+                return "scalar";
+            } break;
+            case Level::SSE42: {
+                return "sse4.2";
+            } break;
+            case Level::AVX2: {
+                return "avx2";
+            } break;
+        }
+        return "";
+    }
+
+    bool from_string(const std::string& str, Level& level) {
+        for (auto l : {Level::Scalar, Level::SSE42, Level::AVX2}) {
+            if (str == to_string(l)) {
+                level = l;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    Level detect() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2") &&
+            __builtin_cpu_supports("popcnt")) {
+            return Level::AVX2;
+        }
+        if (__builtin_cpu_supports("sse4.2") &&
+            __builtin_cpu_supports("popcnt")) {
+            return Level::SSE42;
+        }
+#endif
+        return Level::Scalar;
+    }
+
+    void select(Level level) {
+        Conditions::MUST(level <= detect(), "Kernels: " + to_string(level) +
+                                                " is not supported\n");
+        active = &implementations[(int)level];
+    }
+
+    Level selected() { return active->level; }
+
+    bool check(Level level) {
+        const Implementation& tested = implementations[(int)level];
+        const char alphabet[] =
+            "aeiouAEIOUbcdxyzBCDXYZ   ,.!?-'09\t\x80\xc3\xe9";
+
+        // Deterministic lines, with all the lengths up to a few vectors
+        unsigned int seed = 1;
+        for (size_t size = 0; size < 300; ++size) {
+            for (int round = 0; round < 8; ++round) {
+                std::string line(size, ' ');
+                for (auto& c : line) {
+                    seed = seed * 1103515245 + 12345;
+                    c = alphabet[(seed >> 16) % (sizeof(alphabet) - 1)];
+                }
+
+                // Each kernel must give the same bytes as the reference
+                std::string expected = Reference::horror(line);
+                std::vector<char> actual(2 * size + 1);
+                size_t consonants = std::count_if(
+                    line.begin(), line.end(), Reference::is_consonant);
+                if (tested.count_consonants(line.data(), size) != consonants) {
+                    return false;
+                }
+                if (!matches(expected, actual.data(),
+                             tested.horror(line.data(), size, actual.data()))) {
+                    return false;
+                }
+
+                // The horror kernel also works in place
+                std::copy(line.begin(), line.end(), actual.begin());
+                if (!matches(expected, actual.data(),
+                             tested.horror(actual.data(), size,
+                                           actual.data()))) {
+                    return false;
+                }
+
+                std::pair<size_t (*)(char*, size_t), std::string> kernels[] = {
+                    {tested.comedy, Reference::comedy(line)},
+                    {tested.fantasy, Reference::fantasy(line)},
+                    {[](char* data, size_t count) {
+                         return scifi(data, count);
+                     },
+                     Reference::scifi(line)},
+                };
+                for (auto& [kernel, reference] : kernels) {
+                    std::copy(line.begin(), line.end(), actual.begin());
+                    if (!matches(reference, actual.data(),
+                                 kernel(actual.data(), size))) {
+                        return false;
+                    }
+                }
+            }
+        }
+
+        return true;
+    }
+}    // namespace GenreParser::Kernels
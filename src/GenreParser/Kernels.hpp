@@ -0,0 +1,139 @@
+/**
+ * @file Kernels.hpp
+ * @author Grama Nicolae (gramanicu@gmail.com)
+ * @brief The transformations applied to the lines of each paragraph type
+ * @copyright Copyright (c) 2020
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace GenreParser::Kernels {
+    /**
+     * All the transformations work on a single line (without the newline).
+     * The words are separated by single spaces, so consecutive spaces are
+     * empty words. A space at the end of the line is removed, and the
+     * returned value is the size of the transformed line
+     */
+
+    /**
+     * @brief The size of a line without the space at its end, if it has one
+     */
+    inline size_t trim(const char* line, size_t size) {
+        return (size != 0 && line[size - 1] == ' ') ? size - 1 : size;
+    }
+
+    /**
+     * @brief Reverse every 7th word
+     * @param first_word The index of the first word in the whole line, when
+     * only a piece of the line is transformed
+     */
+    size_t scifi(char* line, size_t size, size_t first_word = 0);
+
+    /**
+     * @brief The instruction sets the kernels are implemented with
+     */
+    enum class Level { Scalar, SSE42, AVX2 };
+
+    std::string to_string(Level level);
+
+    /**
+     * @brief Find a level by its name ("scalar", "sse4.2" or "avx2")
+     * @return false if there is no level with that name
+     */
+    bool from_string(const std::string& str, Level& level);
+
+    /**
+     * @brief The best level supported by the processor
+     */
+    Level detect();
+
+    /**
+     * @brief Use the specified level for the next transformations. It must
+     * be supported by the processor
+     */
+    void select(Level level);
+    Level selected();
+
+    /**
+     * @brief Check that a level produces exactly the same output as the
+     * reference (the original word by word transformations), on generated
+     * lines
+     * @param level The level to be checked
+     * @return true if the outputs are identical
+     */
+    bool check(Level level);
+
+    /**
+     * Each level implements the kernels that can be vectorized, as the static
+     * functions of a type, so the loops over the lines can be instantiated
+     * for a level and call its kernels directly (see visit). The
+     * science-fiction kernel only searches for spaces (with memchr), so it is
+     * only implemented once
+     */
+    struct Scalar {
+        /**
+         * @brief Count the consonants of a line
+         * @param line The line
+         * @param size The size of the line
+         */
+        static size_t count_consonants(const char* line, size_t size);
+
+        /**
+         * @brief Double each consonant (the copy is lowercase)
+         * @param line The line
+         * @param size The size of the line
+         * @param out Where the result is written. It must have room for size
+         * + count_consonants(line, size) characters, and it can be the same
+         * buffer as the line
+         */
+        static size_t horror(const char* line, size_t size, char* out);
+
+        /**
+         * @brief Make every letter on an odd position in its word uppercase
+         */
+        static size_t comedy(char* line, size_t size);
+
+        /**
+         * @brief Make the first letter of each word uppercase
+         */
+        static size_t fantasy(char* line, size_t size);
+    };
+
+    struct SSE42 {
+        static size_t count_consonants(const char* line, size_t size);
+        static size_t horror(const char* line, size_t size, char* out);
+        static size_t comedy(char* line, size_t size);
+        static size_t fantasy(char* line, size_t size);
+    };
+
+    struct AVX2 {
+        static size_t count_consonants(const char* line, size_t size);
+        static size_t horror(const char* line, size_t size, char* out);
+        static size_t comedy(char* line, size_t size);
+        static size_t fantasy(char* line, size_t size);
+    };
+
+    /**
+     * @brief Call a function with the kernels of a level, so the function is
+     * instantiated (and specialized) once for each level
+     * @param level The level
+     * @param function The function, that takes the kernels type as argument
+     */
+    template <typename Function>
+    void visit(Level level, Function&& function) {
+        switch (level) {
+            case Level::Scalar: {
+                function(Scalar{});
+            } break;
+            case Level::SSE42: {
+                function(SSE42{});
+            } break;
+            case Level::AVX2: {
+                function(AVX2{});
+            } break;
+        }
+    }
+}    // namespace GenreParser::Kernels
@@ -0,0 +1,397 @@
+/**
+ * @file KernelsSimd.cpp
+ * @author Grama Nicolae (gramanicu@gmail.com)
+ * @brief Vectorized (SSE4.2 and AVX2) line transformations
+ * @copyright Copyright (c) 2020
+ */
+
+#include <array>
+#include <cstdint>
+
+#include "Helpers.hpp"
+#include "Kernels.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+// The functions are compiled for the specific instruction set, and only
+// called if the processor supports it (see Kernels::detect)
+#define SSE42_TARGET __attribute__((target("sse4.2,popcnt")))
+#define AVX2_TARGET __attribute__((target("avx2,popcnt")))
+
+namespace GenreParser::Kernels {
+    namespace {
+        /**
+         * For the horror kernel, 8 characters are expanded at a time. For
+         * each mask of consonants, the shuffle moves the characters (and the
+         * copies of the consonants) at the end of a 16 bytes register, and
+         * the lowercase mask marks the copies
+         */
+        struct Expansion {
+            std::array<std::array<uint8_t, 16>, 256> shuffle;
+            std::array<std::array<uint8_t, 16>, 256> lowercase;
+        };
+
+        constexpr Expansion make_expansion() {
+            Expansion e{};
+            for (int mask = 0; mask < 256; ++mask) {
+                uint8_t sequence[16] = {};
+                bool copy[16] = {};
+                int length = 0;
+
+                for (int k = 0; k < 8; ++k) {
+                    sequence[length++] = k;
+                    if (mask & (1 << k)) {
+                        copy[length] = true;
+                        sequence[length++] = k;
+                    }
+                }
+
+                for (int i = 0; i < 16; ++i) {
+                    int from = i - (16 - length);
+                    e.shuffle[mask][i] = from < 0 ? 0x80 : sequence[from];
+                    e.lowercase[mask][i] = (from >= 0 && copy[from]) ? 0x20 : 0;
+                }
+            }
+            return e;
+        }
+
+        constexpr Expansion expansion = make_expansion();
+
+        /* SSE4.2 helpers */
+
+        SSE42_TARGET inline __m128i lowercase_letters_128(__m128i c) {
+            __m128i t = _mm_sub_epi8(c, _mm_set1_epi8('a'));
+            return _mm_and_si128(_mm_cmpgt_epi8(t, _mm_set1_epi8(-1)),
+                                 _mm_cmplt_epi8(t, _mm_set1_epi8(26)));
+        }
+
+        SSE42_TARGET inline __m128i consonants_128(__m128i c) {
+            __m128i lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+            __m128i letters = lowercase_letters_128(lower);
+            __m128i vowels = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(lower, _mm_set1_epi8('a')),
+                             _mm_cmpeq_epi8(lower, _mm_set1_epi8('e'))),
+                _mm_or_si128(
+                    _mm_or_si128(_mm_cmpeq_epi8(lower, _mm_set1_epi8('i')),
+                                 _mm_cmpeq_epi8(lower, _mm_set1_epi8('o'))),
+                    _mm_cmpeq_epi8(lower, _mm_set1_epi8('u'))));
+            return _mm_andnot_si128(vowels, letters);
+        }
+
+        /* AVX2 helpers */
+
+        AVX2_TARGET inline __m256i lowercase_letters_256(__m256i c) {
+            __m256i t = _mm256_sub_epi8(c, _mm256_set1_epi8('a'));
+            return _mm256_and_si256(
+                _mm256_cmpgt_epi8(t, _mm256_set1_epi8(-1)),
+                _mm256_cmpgt_epi8(_mm256_set1_epi8(26), t));
+        }
+
+        AVX2_TARGET inline __m256i consonants_256(__m256i c) {
+            __m256i lower = _mm256_or_si256(c, _mm256_set1_epi8(0x20));
+            __m256i letters = lowercase_letters_256(lower);
+            __m256i vowels = _mm256_or_si256(
+                _mm256_or_si256(
+                    _mm256_cmpeq_epi8(lower, _mm256_set1_epi8('a')),
+                    _mm256_cmpeq_epi8(lower, _mm256_set1_epi8('e'))),
+                _mm256_or_si256(
+                    _mm256_or_si256(
+                        _mm256_cmpeq_epi8(lower, _mm256_set1_epi8('i')),
+                        _mm256_cmpeq_epi8(lower, _mm256_set1_epi8('o'))),
+                    _mm256_cmpeq_epi8(lower, _mm256_set1_epi8('u'))));
+            return _mm256_andnot_si256(vowels, letters);
+        }
+
+        /**
+         * @brief Shift the bytes of the register towards the end by K
+         * positions, filling the start with the bytes from the end of carry
+         */
+        template <int K>
+        AVX2_TARGET inline __m256i shift_in_256(__m256i v, __m256i carry) {
+            __m256i low = _mm256_permute2x128_si256(carry, v, 0x21);
+            if constexpr (K == 16) {
+                return low;
+            } else {
+                return _mm256_alignr_epi8(v, low, 16 - K);
+            }
+        }
+
+        /**
+         * @brief The scalar part of the comedy kernel, for the characters
+         * that don't fill a register
+         * @param odd If the first character is on an odd position in its word
+         */
+        void comedy_tail(char* line, size_t size, bool odd) {
+            size_t position = odd;
+            for (size_t i = 0; i < size; ++i) {
+                if (line[i] == ' ') {
+                    position = 0;
+                    continue;
+                }
+                if (position & 1) { line[i] = Utilities::to_upper(line[i]); }
+                position++;
+            }
+        }
+
+        void fantasy_tail(char* line, size_t size, bool word_start) {
+            for (size_t i = 0; i < size; ++i) {
+                if (word_start) { line[i] = Utilities::to_upper(line[i]); }
+                word_start = line[i] == ' ';
+            }
+        }
+
+        /**
+         * @brief Expand the characters from [begin, end) of the line, from
+         * the end, so that the last one is written before out_end
+         * @return The position where the first character was written
+         */
+        size_t horror_tail(const char* line, size_t begin, size_t end,
+                           char* out, size_t out_end) {
+            for (size_t i = end; i-- > begin;) {
+                char c = line[i];
+                if (Utilities::is_consonant(c)) {
+                    out[--out_end] = Utilities::to_lower(c);
+                }
+                out[--out_end] = c;
+            }
+            return out_end;
+        }
+
+        /**
+         * @brief Expand the line from the end, 8 characters at a time. The
+         * 16 bytes store can overwrite up to 8 characters before the group,
+         * so the previous group is always loaded before the store
+         */
+        SSE42_TARGET size_t horror_expand(const char* line, size_t size,
+                                          char* out, size_t out_size) {
+            size_t i = size - size % 8;
+            size_t pos = horror_tail(line, i, size, out, out_size);
+            if (i < 16) {
+                horror_tail(line, 0, i, out, pos);
+                return trim(out, out_size);
+            }
+
+            __m128i group = _mm_loadl_epi64((const __m128i*)(line + i - 8));
+            while (i >= 16) {
+                __m128i previous =
+                    _mm_loadl_epi64((const __m128i*)(line + i - 16));
+
+                int mask = _mm_movemask_epi8(consonants_128(group)) & 0xFF;
+                const auto& shuffle = expansion.shuffle[mask];
+                const auto& lowercase = expansion.lowercase[mask];
+
+                __m128i expanded = _mm_shuffle_epi8(
+                    group, _mm_loadu_si128((const __m128i*)shuffle.data()));
+                expanded = _mm_or_si128(
+                    expanded,
+                    _mm_loadu_si128((const __m128i*)lowercase.data()));
+
+                _mm_storeu_si128((__m128i*)(out + pos - 16), expanded);
+                pos -= 8 + __builtin_popcount(mask);
+
+                group = previous;
+                i -= 8;
+            }
+
+            // The first group was loaded before it could be overwritten
+            char first[8];
+            _mm_storel_epi64((__m128i*)first, group);
+            horror_tail(first, 0, 8, out, pos);
+
+            return trim(out, out_size);
+        }
+    }    // namespace
+
+    /* SSE4.2 kernels */
+
+    SSE42_TARGET size_t SSE42::count_consonants(const char* line,
+                                                size_t size) {
+        size_t count = 0, i = 0;
+        for (; i + 16 <= size; i += 16) {
+            __m128i c = _mm_loadu_si128((const __m128i*)(line + i));
+            count += __builtin_popcount(
+                _mm_movemask_epi8(consonants_128(c)));
+        }
+        return count + Scalar::count_consonants(line + i, size - i);
+    }
+
+    SSE42_TARGET size_t SSE42::horror(const char* line, size_t size,
+                                      char* out) {
+        size_t out_size = size + count_consonants(line, size);
+        return horror_expand(line, size, out, out_size);
+    }
+
+    SSE42_TARGET size_t SSE42::comedy(char* line, size_t size) {
+        const __m128i index = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+                                            11, 12, 13, 14, 15);
+        const __m128i one = _mm_set1_epi8(1);
+
+        // The position of the last space before the register. Only its
+        // parity matters, so it is kept as -1 or -2 (the line starts after
+        // an imaginary space, at -1)
+        int8_t last_space = -1;
+
+        size_t i = 0;
+        for (; i + 16 <= size; i += 16) {
+            __m128i c = _mm_loadu_si128((const __m128i*)(line + i));
+            __m128i carry = _mm_set1_epi8(last_space);
+
+            // For each character, the index of the last space before it
+            __m128i spaces =
+                _mm_blendv_epi8(carry, index,
+                                _mm_cmpeq_epi8(c, _mm_set1_epi8(' ')));
+            spaces = _mm_max_epi8(spaces, _mm_alignr_epi8(spaces, carry, 15));
+            spaces = _mm_max_epi8(spaces, _mm_alignr_epi8(spaces, carry, 14));
+            spaces = _mm_max_epi8(spaces, _mm_alignr_epi8(spaces, carry, 12));
+            spaces = _mm_max_epi8(spaces, _mm_alignr_epi8(spaces, carry, 8));
+
+            // Uppercase the letters on odd positions in their words
+            __m128i position =
+                _mm_sub_epi8(_mm_sub_epi8(index, spaces), one);
+            __m128i odd =
+                _mm_cmpeq_epi8(_mm_and_si128(position, one), one);
+            __m128i change = _mm_and_si128(odd, lowercase_letters_128(c));
+            c = _mm_sub_epi8(c, _mm_and_si128(change, _mm_set1_epi8(0x20)));
+            _mm_storeu_si128((__m128i*)(line + i), c);
+
+            last_space = (_mm_extract_epi8(spaces, 15) & 1) ? -1 : -2;
+        }
+
+        comedy_tail(line + i, size - i, last_space == -2);
+        return trim(line, size);
+    }
+
+    SSE42_TARGET size_t SSE42::fantasy(char* line, size_t size) {
+        char last = ' ';
+
+        size_t i = 0;
+        for (; i + 16 <= size; i += 16) {
+            __m128i c = _mm_loadu_si128((const __m128i*)(line + i));
+            __m128i previous = _mm_alignr_epi8(c, _mm_set1_epi8(last), 15);
+
+            __m128i change =
+                _mm_and_si128(_mm_cmpeq_epi8(previous, _mm_set1_epi8(' ')),
+                              lowercase_letters_128(c));
+            last = _mm_extract_epi8(c, 15);
+
+            c = _mm_sub_epi8(c, _mm_and_si128(change, _mm_set1_epi8(0x20)));
+            _mm_storeu_si128((__m128i*)(line + i), c);
+        }
+
+        fantasy_tail(line + i, size - i, last == ' ');
+        return trim(line, size);
+    }
+
+    /* AVX2 kernels */
+
+    AVX2_TARGET size_t AVX2::count_consonants(const char* line, size_t size) {
+        size_t count = 0, i = 0;
+        for (; i + 32 <= size; i += 32) {
+            __m256i c = _mm256_loadu_si256((const __m256i*)(line + i));
+            count += __builtin_popcount(
+                _mm256_movemask_epi8(consonants_256(c)));
+        }
+        return count + SSE42::count_consonants(line + i, size - i);
+    }
+
+    AVX2_TARGET size_t AVX2::horror(const char* line, size_t size,
+                                    char* out) {
+        // The expansion itself works on 8 characters at a time, so only the
+        // counting pass uses the wider registers
+        size_t out_size = size + count_consonants(line, size);
+        return horror_expand(line, size, out, out_size);
+    }
+
+    AVX2_TARGET size_t AVX2::comedy(char* line, size_t size) {
+        const __m256i index = _mm256_setr_epi8(
+            0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18,
+            19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31);
+        const __m256i one = _mm256_set1_epi8(1);
+        int8_t last_space = -1;
+
+        size_t i = 0;
+        for (; i + 32 <= size; i += 32) {
+            __m256i c = _mm256_loadu_si256((const __m256i*)(line + i));
+            __m256i carry = _mm256_set1_epi8(last_space);
+
+            __m256i spaces = _mm256_blendv_epi8(
+                carry, index, _mm256_cmpeq_epi8(c, _mm256_set1_epi8(' ')));
+            spaces = _mm256_max_epi8(spaces, shift_in_256<1>(spaces, carry));
+            spaces = _mm256_max_epi8(spaces, shift_in_256<2>(spaces, carry));
+            spaces = _mm256_max_epi8(spaces, shift_in_256<4>(spaces, carry));
+            spaces = _mm256_max_epi8(spaces, shift_in_256<8>(spaces, carry));
+            spaces = _mm256_max_epi8(spaces, shift_in_256<16>(spaces, carry));
+
+            __m256i position =
+                _mm256_sub_epi8(_mm256_sub_epi8(index, spaces), one);
+            __m256i odd =
+                _mm256_cmpeq_epi8(_mm256_and_si256(position, one), one);
+            __m256i change = _mm256_and_si256(odd, lowercase_letters_256(c));
+            c = _mm256_sub_epi8(
+                c, _mm256_and_si256(change, _mm256_set1_epi8(0x20)));
+            _mm256_storeu_si256((__m256i*)(line + i), c);
+
+            last_space = (_mm256_extract_epi8(spaces, 31) & 1) ? -1 : -2;
+        }
+
+        comedy_tail(line + i, size - i, last_space == -2);
+        return trim(line, size);
+    }
+
+    AVX2_TARGET size_t AVX2::fantasy(char* line, size_t size) {
+        char last = ' ';
+
+        size_t i = 0;
+        for (; i + 32 <= size; i += 32) {
+            __m256i c = _mm256_loadu_si256((const __m256i*)(line + i));
+            __m256i previous = shift_in_256<1>(c, _mm256_set1_epi8(last));
+
+            __m256i change = _mm256_and_si256(
+                _mm256_cmpeq_epi8(previous, _mm256_set1_epi8(' ')),
+                lowercase_letters_256(c));
+            last = _mm256_extract_epi8(c, 31);
+
+            c = _mm256_sub_epi8(
+                c, _mm256_and_si256(change, _mm256_set1_epi8(0x20)));
+            _mm256_storeu_si256((__m256i*)(line + i), c);
+        }
+
+        fantasy_tail(line + i, size - i, last == ' ');
+        return trim(line, size);
+    }
+}    // namespace GenreParser::Kernels
+
+#else
+
+// Other architectures only use the scalar kernels (detect never selects
+// these levels)
+namespace GenreParser::Kernels {
+    size_t SSE42::count_consonants(const char* line, size_t size) {
+        return Scalar::count_consonants(line, size);
+    }
+    size_t SSE42::horror(const char* line, size_t size, char* out) {
+        return Scalar::horror(line, size, out);
+    }
+    size_t SSE42::comedy(char* line, size_t size) {
+        return Scalar::comedy(line, size);
+    }
+    size_t SSE42::fantasy(char* line, size_t size) {
+        return Scalar::fantasy(line, size);
+    }
+    size_t AVX2::count_consonants(const char* line, size_t size) {
+        return Scalar::count_consonants(line, size);
+    }
+    size_t AVX2::horror(const char* line, size_t size, char* out) {
+        return Scalar::horror(line, size, out);
+    }
+    size_t AVX2::comedy(char* line, size_t size) {
+        return Scalar::comedy(line, size);
+    }
+    size_t AVX2::fantasy(char* line, size_t size) {
+        return Scalar::fantasy(line, size);
+    }
+}    // namespace GenreParser::Kernels
+
+#endif
@@ -0,0 +1,240 @@
+/**
+ * @file Options.cpp
+ * @author Grama Nicolae (gramanicu@gmail.com)
+ * @brief Command line options parsing
+ * @copyright Copyright (c) 2020
+ */
+
+#include "Options.hpp"
+
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <set>
+
+namespace GenreParser {
+    long parse_number(const std::string& name, const char* value) {
+        Conditions::MUST(value != nullptr, name + ": Value not provided\n");
+
+        char* end;
+        long number = std::strtol(value, &end, 10);
+        Conditions::MUST(*end == '\0' && number > 0,
+                         name + ": Invalid value \"" + value + "\"\n");
+        return number;
+    }
+
+    long parse_size(const std::string& name, const char* value) {
+        Conditions::MUST(value != nullptr, name + ": Value not provided\n");
+
+        char* end;
+        long number = std::strtol(value, &end, 10);
+        switch (*end) {
+            case 'K': number <<= 10, ++end; break;
+            case 'M': number <<= 20, ++end; break;
+            case 'G': number <<= 30, ++end; break;
+        }
+        Conditions::MUST(*end == '\0' && number > 0,
+                         name + ": Invalid value \"" + value + "\"\n");
+        return number;
+    }
+
+    Options Options::parse(int argc, char* argv[]) {
+        Options options;
+        options.threads = std::max(1u, std::thread::hardware_concurrency());
+        options.scan_threads = options.threads;
+
+        const char* trace = std::getenv("GENRE_PARSER_TRACE");
+        options.trace = trace != nullptr && *trace != '\0' &&
+                        std::string(trace) != "0";
+
+        for (int i = 1; i < argc; ++i) {
+            std::string arg(argv[i]);
+            const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+            if (arg == "--window") {
+                options.window = parse_number(arg, value);
+                Conditions::MUST(options.window <= Constants::MAX_TAG,
+                                 arg + ": The window is too large\n");
+                ++i;
+            } else if (arg == "--threads") {
+                options.threads = parse_number(arg, value);
+                ++i;
+            } else if (arg == "--task-bytes") {
+                options.task_bytes = parse_size(arg, value);
+                ++i;
+            } else if (arg == "--task-time") {
+                options.task_time = parse_number(arg, value);
+                ++i;
+            } else if (arg == "--buffers") {
+                options.buffers = parse_number(arg, value);
+                ++i;
+            } else if (arg == "--split-lines") {
+                options.split_lines = true;
+            } else if (arg == "--simd") {
+                Conditions::MUST(value != nullptr &&
+                                     Kernels::from_string(value, options.simd),
+                                 arg + ": Expected scalar, sse4.2 or avx2\n");
+                ++i;
+            } else if (arg == "--check-kernels") {
+                options.check_kernels = true;
+            } else if (arg == "--compress") {
+                Conditions::MUST(
+                    value != nullptr &&
+                        Codec::from_string(value, options.compress),
+                    arg + ": Expected off, on or auto\n");
+                ++i;
+            } else if (arg == "--compress-threshold") {
+                options.compress_threshold = parse_size(arg, value);
+                ++i;
+            } else if (arg == "--pwrite") {
+                options.pwrite = true;
+            } else if (arg == "--local") {
+                options.local = true;
+            } else if (arg == "--trace") {
+                options.trace = true;
+            } else if (arg == "--batch-count") {
+                options.batch_count = parse_number(arg, value);
+                ++i;
+            } else if (arg == "--batch-bytes") {
+                options.batch_bytes = parse_size(arg, value);
+                ++i;
+            } else if (arg == "--split-bytes") {
+                options.split_bytes = parse_size(arg, value);
+                ++i;
+            } else if (arg == "--memory-budget") {
+                options.memory_budget = parse_size(arg, value);
+                ++i;
+            } else if (arg == "--manifest") {
+                Conditions::MUST(value != nullptr,
+                                 arg + ": Value not provided\n");
+                options.manifest = value;
+                ++i;
+            } else if (arg == "--cache") {
+                Conditions::MUST(value != nullptr,
+                                 arg + ": Value not provided\n");
+                options.cache = value;
+                ++i;
+            } else if (arg == "--cache-size") {
+                options.cache_size = parse_size(arg, value);
+                ++i;
+            } else if (arg == "--scan-threads") {
+                options.scan_threads = parse_number(arg, value);
+                ++i;
+            } else if (arg == "--open-files") {
+                options.open_files = parse_number(arg, value);
+                ++i;
+            } else {
+                Conditions::MUST(arg.rfind("--", 0) != 0,
+                                 arg + ": Unknown option\n");
+                options.input_paths.push_back(arg);
+            }
+        }
+
+        // Larger batches or parts would not fit in a message
+        Conditions::MUST(options.batch_bytes <= Constants::MAX_BATCH_BYTES,
+                         "--batch-bytes: At most " +
+                             std::to_string(Constants::MAX_BATCH_BYTES) +
+                             " bytes\n");
+        Conditions::MUST(options.batch_count <= Constants::MAX_BATCH_COUNT,
+                         "--batch-count: At most " +
+                             std::to_string(Constants::MAX_BATCH_COUNT) +
+                             " paragraphs\n");
+        Conditions::MUST(
+            (size_t)options.split_bytes <= Constants::MAX_PARAGRAPH_BYTES,
+            "--split-bytes: At most " +
+                std::to_string(Constants::MAX_PARAGRAPH_BYTES) + " bytes\n");
+
+        return options;
+    }
+
+    std::string with_extension(const std::string& path,
+                               const std::string& extension) {
+        // Only a dot in the file name, not in a directory ("./file")
+        size_t dot = path.find_last_of('.');
+        size_t slash = path.find_last_of('/');
+        if (dot == std::string::npos ||
+            (slash != std::string::npos && dot < slash)) {
+            return path + extension;
+        }
+        return path.substr(0, dot) + extension;
+    }
+
+    std::vector<std::string> Options::inputs() const {
+        std::vector<std::string> paths;
+
+        auto ends_with = [](const std::string& str, const std::string& end) {
+            return str.size() >= end.size() &&
+                   str.compare(str.size() - end.size(), end.size(), end) == 0;
+        };
+
+        for (auto& path : input_paths) {
+            struct stat info;
+            if (stat(path.c_str(), &info) != 0 || !S_ISDIR(info.st_mode)) {
+                paths.push_back(path);
+                continue;
+            }
+
+            DIR* directory = opendir(path.c_str());
+            Conditions::MUST(directory != nullptr,
+                             path + ": Directory could not be opened\n");
+
+            std::vector<std::string> files;
+            while (dirent* entry = readdir(directory)) {
+                std::string name = entry->d_name;
+                std::string file = path + "/" + name;
+                if (name[0] == '.' || ends_with(name, ".out") ||
+                    ends_with(name, ".trace.json") ||
+                    stat(file.c_str(), &info) != 0 || !S_ISREG(info.st_mode)) {
+                    continue;
+                }
+                files.push_back(file);
+            }
+            closedir(directory);
+
+            std::sort(files.begin(), files.end());
+            paths.insert(paths.end(), files.begin(), files.end());
+        }
+
+        if (!manifest.empty()) {
+            std::ifstream list(manifest);
+            Conditions::MUST(list.is_open(),
+                             manifest + ": Manifest could not be opened\n");
+
+            std::string line;
+            while (std::getline(list, line)) {
+                if (!line.empty()) { paths.push_back(line); }
+            }
+        }
+
+        // The same file can be given through different paths, so they are
+        // compared after they are resolved
+        std::vector<std::string> unique;
+        std::set<std::string> seen;
+        std::map<std::string, std::string> outputs;
+        for (auto& path : paths) {
+            char resolved[PATH_MAX];
+            std::string real =
+                realpath(path.c_str(), resolved) != nullptr ? resolved : path;
+            if (!seen.insert(real).second) { continue; }
+
+            auto [output, added] =
+                outputs.emplace(with_extension(real, ".out"), path);
+            Conditions::MUST(added, path + ": Has the same output file as " +
+                                        output->second + "\n");
+            unique.push_back(path);
+        }
+
+        // An input can't be overwritten by the output of another one
+        for (auto& [output, path] : outputs) {
+            Conditions::MUST(seen.count(output) == 0,
+                             path + ": Its output file is also an input\n");
+        }
+
+        return unique;
+    }
+}    // namespace GenreParser
@@ -0,0 +1,138 @@
+/**
+ * @file Options.hpp
+ * @author Grama Nicolae (gramanicu@gmail.com)
+ * @brief Command line options of the parser
+ * @copyright Copyright (c) 2020
+ */
+
+#pragma once
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Codec.hpp"
+#include "Helpers.hpp"
+#include "Kernels.hpp"
+
+namespace GenreParser {
+    /**
+     * @brief Convert the value of an option to a positive number
+     * @param name The name of the option
+     * @param value The value of the option
+     * @return The number
+     */
+    long parse_number(const std::string& name, const char* value);
+
+    /**
+     * @brief Convert the value of an option to a size in bytes. The value
+     * can end with K, M or G
+     * @param name The name of the option
+     * @param value The value of the option
+     * @return The size
+     */
+    long parse_size(const std::string& name, const char* value);
+
+    /**
+     * @brief Replace the extension of a file name (the part after its last
+     * dot), or add one if it has none
+     * @param path The path of the file
+     * @param extension The new extension, with its dot
+     * @return The path with the new extension
+     */
+    std::string with_extension(const std::string& path,
+                               const std::string& extension);
+
+    struct Options {
+        // The input files, directories (all their files are processed) and
+        // manifest (a file with the path of an input file on each line)
+        std::vector<std::string> input_paths;
+        std::string manifest;
+
+        // The number of input files that are processed at the same time
+        int open_files = Constants::DEFAULT_OPEN_FILES;
+
+        // Number of paragraphs a master thread can have sent to its worker,
+        // without having received them back
+        int window = Constants::DEFAULT_WINDOW;
+
+        // A batch is sent when it has this many paragraphs, or bytes
+        int batch_count = Constants::DEFAULT_BATCH_COUNT;
+        long batch_bytes = Constants::DEFAULT_BATCH_BYTES;
+
+        // Paragraphs larger than this are split into parts, that are
+        // processed by multiple workers
+        long split_bytes = Constants::DEFAULT_SPLIT_BYTES;
+
+        // The maximum size of the paragraphs kept by the master (read, but
+        // not written yet), or 0 for no limit
+        long memory_budget = 0;
+
+        // The number of threads that process the paragraphs, on each worker
+        int threads;
+
+        // The number of threads that find the paragraphs of a large input
+        // file, on the master
+        int scan_threads;
+
+        // The bytes processed by a task of the thread pool. By default (0),
+        // the size is adjusted so that a task takes task_time microseconds.
+        // Lines longer than a task can also be split between words
+        long task_bytes = 0;
+        long task_time = Constants::DEFAULT_TASK_TIME;
+        bool split_lines = false;
+
+        // The number of batches a worker holds: while one is processed, the
+        // next ones are received and the replies of the previous ones are
+        // sent
+        int buffers = Constants::DEFAULT_BUFFERS;
+
+        // The instruction set used by the transformations, and if they should
+        // be checked against the scalar ones before processing
+        Kernels::Level simd = Kernels::detect();
+        bool check_kernels = false;
+
+        // The compression of the messages between the master and the workers.
+        // Smaller messages are never compressed
+        Codec::Mode compress = Codec::Mode::Off;
+        long compress_threshold = Constants::DEFAULT_COMPRESS_THRESHOLD;
+
+        // Write the processed paragraphs at their offsets in the output, from
+        // the threads that receive them, instead of a single writer thread.
+        // The reader computes the offsets, from the exact size of each
+        // processed paragraph
+        bool pwrite = false;
+
+        // The directory of the cache of processed paragraphs (no cache, if
+        // empty), and its maximum size
+        std::string cache;
+        long cache_size = Constants::DEFAULT_CACHE_SIZE;
+
+        // Run the whole pipeline in this process, with threads, without MPI
+        bool local = false;
+
+        // Record the stages of each thread, and write them as a trace. It
+        // can also be enabled with the GENRE_PARSER_TRACE variable
+        bool trace = false;
+
+        /**
+         * @brief Parse the command line arguments. An option either has a
+         * value ("--name value") or is a flag, without one ("--local",
+         * "--pwrite"). The other arguments are the input files and
+         * directories
+         * @param argc The number of arguments
+         * @param argv The arguments
+         * @return The parsed options
+         */
+        static Options parse(int argc, char* argv[]);
+
+        /**
+         * @brief The input files, in order: the files given as arguments, the
+         * files of the directories given as arguments (sorted by name, without
+         * the hidden and the output files) and the files in the manifest. A
+         * file that is given multiple times is only kept the first time, and
+         * two files can't have the same output file (a.txt and a.dat)
+         */
+        std::vector<std::string> inputs() const;
+    };
+}    // namespace GenreParser
@@ -0,0 +1,142 @@
+/**
+ * @file OutputFile.cpp
+ * @author Grama Nicolae (gramanicu@gmail.com)
+ * @brief Output file writer implementation
+ * @copyright Copyright (c) 2020
+ */
+
+#include "OutputFile.hpp"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cerrno>
+
+#include "Helpers.hpp"
+
+namespace GenreParser {
+    OutputFile::OutputFile(const std::string& path, bool positioned)
+        : path(path) {
+        if (positioned) {
+            fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            return;
+        }
+
+        file = std::fopen(path.c_str(), "w");
+        if (file == nullptr) { return; }
+        fd = fileno(file);
+
+        buffer.resize(Constants::WRITE_BUFFER_SIZE);
+        std::setvbuf(file, buffer.data(), _IOFBF, buffer.size());
+    }
+
+    OutputFile::~OutputFile() {
+        if (file != nullptr) {
+            std::fclose(file);
+        } else if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    bool OutputFile::is_open() const { return fd >= 0; }
+
+    void OutputFile::close() {
+        bool closed = true;
+        if (file != nullptr) {
+            closed = std::fclose(file) == 0;
+        } else if (fd >= 0) {
+            closed = ::close(fd) == 0;
+        }
+        file = nullptr;
+        fd = -1;
+        Conditions::MUST(closed, path + ": Output file could not be written\n");
+    }
+
+    size_t OutputFile::write_paragraph(const Assembly& paragraph) {
+        bool written = next == 0 || std::fputc('\n', file) != EOF;
+        for (auto& part : paragraph.parts) {
+            written = written && std::fwrite(part.data(), 1, part.size(),
+                                             file) == part.size();
+        }
+        Conditions::MUST(written && !std::ferror(file),
+                         path + ": Output file could not be written\n");
+        next++;
+        parts_written += paragraph.parts.size();
+        return paragraph.footprint;
+    }
+
+    size_t OutputFile::write(Processed paragraph) {
+        Assembly& assembly = pending[paragraph.sequence];
+        if (assembly.parts.empty()) {
+            assembly.parts.resize(paragraph.parts);
+            assembly.missing = paragraph.parts;
+        }
+        assembly.parts[paragraph.part] = std::move(paragraph.data);
+        assembly.missing--;
+        assembly.footprint += paragraph.footprint;
+
+        // Write the complete paragraphs that are next in order
+        size_t written = 0;
+        for (auto it = pending.begin(); it != pending.end() &&
+                                        it->first == next &&
+                                        it->second.missing == 0;
+             it = pending.erase(it)) {
+            written += write_paragraph(it->second);
+        }
+        return written;
+    }
+
+    size_t OutputFile::written() const { return parts_written; }
+
+    void OutputFile::write_at(const std::vector<Placed>& paragraphs) {
+        static const char separator = '\n';
+        std::vector<iovec> vectors;
+        size_t start = 0, end = 0;
+
+        // Write the consecutive paragraphs, until everything was written
+        auto flush = [&] {
+            iovec* vector = vectors.data();
+            int count = vectors.size();
+            while (count > 0) {
+                ssize_t written = pwritev(fd, vector, count, start);
+                if (written < 0 && errno == EINTR) { continue; }
+                Conditions::MUST(written > 0,
+                                 path + ": Output file could not be written\n");
+
+                start += written;
+                while (count > 0 && (size_t)written >= vector->iov_len) {
+                    written -= vector->iov_len;
+                    ++vector, --count;
+                }
+                if (count > 0) {
+                    vector->iov_base = (char*)vector->iov_base + written;
+                    vector->iov_len -= written;
+                }
+            }
+            vectors.clear();
+        };
+
+        for (auto& paragraph : paragraphs) {
+            size_t offset = paragraph.offset - (paragraph.separator ? 1 : 0);
+            if (offset != end || vectors.size() + 2 > IOV_MAX) {
+                flush();
+                start = offset;
+            }
+
+            if (paragraph.separator) {
+                vectors.push_back({(void*)&separator, 1});
+            }
+            vectors.push_back(
+                {(void*)paragraph.data.data(), paragraph.data.size()});
+            end = paragraph.offset + paragraph.data.size();
+        }
+        flush();
+    }
+
+    void OutputFile::resize(size_t size) {
+        Conditions::MUST(ftruncate(fd, size) == 0,
+                         path + ": Output file could not be resized\n");
+    }
+}    // namespace GenreParser
@@ -0,0 +1,119 @@
+/**
+ * @file OutputFile.hpp
+ * @author Grama Nicolae (gramanicu@gmail.com)
+ * @brief Output file writer, that restores the order of the paragraphs
+ * @copyright Copyright (c) 2020
+ */
+
+#pragma once
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace GenreParser {
+    /**
+     * @brief A processed paragraph (or a part of it), and its position in the
+     * input file. Only the first part starts with the header line
+     */
+    struct Processed {
+        size_t file;
+        size_t sequence;
+        size_t part;
+        size_t parts;
+        std::string data;
+        size_t footprint;    // The memory reserved for the paragraph
+    };
+
+    /**
+     * @brief A processed paragraph (or a part of it), and where it is written
+     * in the output file. The first part of every paragraph, except the first
+     * one, is preceded by the empty line that separates the paragraphs
+     */
+    struct Placed {
+        size_t offset;
+        std::string_view data;
+        bool separator;
+    };
+
+    class OutputFile {
+       private:
+        std::string path;
+
+        // Only the files written in order have a stdio stream (and buffer)
+        int fd = -1;
+        FILE* file = nullptr;
+        std::vector<char> buffer;
+
+        // A paragraph that is waiting for its parts, or for the paragraphs
+        // before it
+        struct Assembly {
+            std::vector<std::string> parts;
+            size_t missing = 0;
+            size_t footprint = 0;
+        };
+
+        std::map<size_t, Assembly> pending;
+        size_t next = 0;
+        size_t parts_written = 0;
+
+        /**
+         * @brief Write a paragraph that is next in order
+         * @return The memory that was reserved for the paragraph
+         */
+        size_t write_paragraph(const Assembly& paragraph);
+
+       public:
+        /**
+         * @brief Create (or truncate) the output file
+         * @param path The path of the file
+         * @param positioned If the file is only written with write_at, so it
+         * doesn't need a write buffer
+         */
+        explicit OutputFile(const std::string& path, bool positioned = false);
+        ~OutputFile();
+
+        OutputFile(const OutputFile&) = delete;
+        OutputFile& operator=(const OutputFile&) = delete;
+
+        bool is_open() const;
+
+        /**
+         * @brief Flush and close the file, checking that everything was
+         * written (the destructor doesn't check it)
+         */
+        void close();
+
+        /**
+         * @brief Write a paragraph, if all its parts arrived and all the
+         * paragraphs before it were written, or keep it until then. The
+         * paragraphs are separated by an empty line
+         * @param paragraph The processed paragraph, or a part of it
+         * @return The memory reserved for the paragraphs that were written
+         */
+        size_t write(Processed paragraph);
+
+        /**
+         * @brief The number of parts (or whole paragraphs) written by write
+         */
+        size_t written() const;
+
+        /**
+         * @brief Write processed paragraphs straight at their offsets, that
+         * are known in advance. It can be called by multiple threads at the
+         * same time (but not together with write). The paragraphs that are
+         * next to each other in the file are written with a single call
+         * @param paragraphs The paragraphs, in any order
+         */
+        void write_at(const std::vector<Placed>& paragraphs);
+
+        /**
+         * @brief Set the size of the file (the paragraphs written with
+         * write_at can be written in any order)
+         * @param size The size of the file
+         */
+        void resize(size_t size);
+    };
+}    // namespace GenreParser
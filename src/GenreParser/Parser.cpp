@@ -8,33 +8,190 @@
 #include "Parser.hpp"
 
 namespace GenreParser {
-    Enums::GenresType Parser::current_out_type;
-    pthread_barrier_t Parser::barrier;
-    std::vector<int> Parser::output_order;
-    bool Parser::output_created;
+    namespace {
+        /**
+         * @brief The memory needed by the master for a paragraph, until it is
+         * written: the paragraph and the buffer for the processed paragraph
+         * (at most twice as large, plus a newline)
+         */
+        size_t footprint(const Paragraph& paragraph) {
+            return 3 * (paragraph.header.size() + paragraph.size) + 1;
+        }
+
+        /**
+         * @brief The exact size of a processed paragraph (or part), as the
+         * master receives it. Only the first part has the header line
+         */
+        size_t processed_size(const Paragraph& paragraph) {
+            std::string_view lines(paragraph.data, paragraph.size);
+            if (paragraph.header.empty()) {
+                size_t newline = lines.find('\n');
+                lines.remove_prefix(newline == std::string_view::npos
+                                        ? lines.size()
+                                        : newline + 1);
+            }
+
+            size_t size = Genres::output_size(paragraph.type, lines.data(),
+                                              lines.size());
+            if (paragraph.part == 0) {
+                size += Genres::header(paragraph.type).size() + 1;
+            }
+            return size;
+        }
+
+        /**
+         * @brief The place of a processed paragraph in the output file
+         * @param paragraph The paragraph
+         * @param data The processed paragraph
+         */
+        Placed placed(const Paragraph& paragraph, std::string_view data) {
+            Conditions::MUST(data.size() == paragraph.output_size,
+                             "Unexpected size of a processed paragraph\n");
+            return {paragraph.output_offset, data,
+                    paragraph.part == 0 && paragraph.sequence != 0};
+        }
+
+        /**
+         * @brief Split a line in pieces of about max_size bytes, that can be
+         * transformed on their own: a piece ends before a space that doesn't
+         * follow another space, so only the last piece can end with a space
+         * (that is removed, as for the whole line). Each of the other pieces
+         * starts with a space, so its first word is empty, and it has the
+         * index of the last word of the previous piece
+         * @param line The line
+         * @param size The size of the line
+         * @param max_size The size of a piece
+         * @param pieces Where the pieces are added
+         */
+        void split_line(const char* line, size_t size, size_t max_size,
+                        std::vector<LinePiece>& pieces) {
+            size_t start = 0, first_word = 0;
+
+            while (size - start > max_size) {
+                size_t stop = start + max_size;
+                while (stop < size &&
+                       (line[stop] != ' ' || line[stop - 1] == ' ')) {
+                    ++stop;
+                }
+                if (stop == size) { break; }
+
+                pieces.push_back(
+                    {line + start, stop - start, first_word, false});
+                first_word += std::count(line + start, line + stop, ' ');
+                start = stop;
+            }
+            pieces.push_back({line + start, size - start, first_word, true});
+        }
+
+        /**
+         * @brief A batch received by a worker, and its reply. A worker has
+         * more of them, used in a ring, so it can receive the next batches and
+         * send the replies of the previous ones while it processes a batch
+         */
+        struct WorkerBuffer {
+            std::vector<char> message;
+            int size = 0;
+            int tag = 0;
+            MPI_Request receive = MPI_REQUEST_NULL;
+
+            std::vector<char> decompressed;
+
+            std::vector<std::string_view> raw;
+            Arena arena;
+            std::vector<char> compressed;
+            MPI_Request reply = MPI_REQUEST_NULL;
+        };
+    }    // namespace
+
+    std::vector<std::unique_ptr<Utilities::BlockingQueue<Paragraph>>>
+        Parser::paragraph_queues;
+    Utilities::BlockingQueue<Processed> Parser::processed_queue;
+    Utilities::MemoryBudget Parser::budget;
+    Utilities::MemoryBudget Parser::open_files;
+    Utilities::Scheduler Parser::scheduler;
+    Utilities::TaskSizer Parser::task_sizer;
 
     Parser::Parser(int argc, char* argv[]) {
-        int provided;
-        MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
+        options = Options::parse(argc, argv);
 
-        // Check if provided = MPI_THREAD_MULTIPLE
-        Conditions::MUST(provided == MPI_THREAD_MULTIPLE,
-                         "Couldn't init MPI\n");
+        if (options.local) {
+            // A single process, without MPI
+            worker_count = 1;
+            worker_rank = Constants::MASTER;
+        } else {
+            int provided;
+            MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
 
-        MPI_Comm_size(MPI_COMM_WORLD, &worker_count);
-        MPI_Comm_rank(MPI_COMM_WORLD, &worker_rank);
+            // Check if provided = MPI_THREAD_MULTIPLE
+            Conditions::MUST(provided == MPI_THREAD_MULTIPLE,
+                             "Couldn't init MPI\n");
 
-        node_type = static_cast<Enums::NodesType>(worker_rank);
+            MPI_Comm_size(MPI_COMM_WORLD, &worker_count);
+            MPI_Comm_rank(MPI_COMM_WORLD, &worker_rank);
+        }
+
+        node_type = worker_rank == Constants::MASTER ? Enums::NodesType::Master
+                                                     : Enums::NodesType::Worker;
+        Kernels::select(options.simd);
+        if (options.task_bytes != 0) {
+            task_sizer.set_fixed(options.task_bytes);
+        } else {
+            task_sizer.set_adaptive(options.task_time * 1000);
+        }
+        if (options.trace) { Trace::enable(); }
+
+        if (options.check_kernels) {
+            for (auto level : {Kernels::Level::Scalar, Kernels::Level::SSE42,
+                               Kernels::Level::AVX2}) {
+                if (level > Kernels::detect()) { continue; }
+                Conditions::MUST(Kernels::check(level),
+                                 "Kernels: " + Kernels::to_string(level) +
+                                     " output differs from the reference\n");
+            }
+        }
 
         if (node_type == Enums::NodesType::Master) {
-            // Check if the input file was provided
-            Conditions::MUST(argc >= 2, to_string(node_type) +
-                                            ": Input file not provided\n");
-            input_path = std::string(argv[1]);
-            output_path =
-                input_path.substr(0, input_path.find_last_of('.')) + ".out";
-            output_created = false;
-            pthread_barrier_init(&barrier, NULL, Constants::MASTER_THREADS);
+            // Check if the input files were provided. They are opened by
+            // the reader
+            for (auto& path : options.inputs()) {
+                jobs.push_back(std::make_unique<Job>());
+                jobs.back()->input_path = path;
+                jobs.back()->output_path = with_extension(path, ".out");
+            }
+            Conditions::MUST(
+                !jobs.empty(),
+                to_string(node_type) + ": Input file not provided\n");
+            Conditions::MUST(
+                options.local || worker_count > 1,
+                to_string(node_type) + ": At least one worker is needed\n");
+
+            // The trace of all the files is next to the first one
+            const std::string& first = jobs[0]->input_path;
+            trace_path = with_extension(first, ".trace.json");
+            budget.set_limit(options.memory_budget);
+            open_files.set_limit(options.open_files);
+            if (!options.cache.empty()) {
+                cache = std::make_unique<ResultCache>(
+                    options.cache, options.cache_size, budget);
+            }
+
+            // In local mode, there is a single queue, of the processor
+            for (int worker = 1; worker < std::max(worker_count, 2);
+                 ++worker) {
+                paragraph_queues.push_back(
+                    std::make_unique<Utilities::BlockingQueue<Paragraph>>());
+            }
+            scheduler.set_workers(paragraph_queues.size());
+        }
+
+        if (options.compress == Codec::Mode::Auto && !options.local) {
+            measure_bandwidth();
+        }
+
+        // The nodes start their clocks at about the same time
+        if (Trace::is_enabled()) {
+            if (!options.local) { MPI_Barrier(MPI_COMM_WORLD); }
+            Trace::start();
         }
     }
 
@@ -44,311 +201,835 @@ namespace GenreParser {
         switch (node_type) {
             case NodesType::Master: {
                 std::vector<std::thread> master_threads;
+                std::thread reader(&Parser::read_file, this);
 
-                for (int thread_id = 0; thread_id < Constants::MASTER_THREADS;
+                // With pwrite, the paragraphs are written by the threads that
+                // receive them
+                std::thread writer;
+                if (!options.pwrite) {
+                    writer = std::thread(&Parser::write_file, this);
+                }
+
+                if (options.local) {
+                    pool = std::make_unique<ThreadPool>(options.threads);
+                    master_threads.push_back(
+                        std::thread(&Parser::process_local, this));
+                }
+                for (int thread_id = 0; thread_id < worker_count - 1;
                      ++thread_id) {
                     master_threads.push_back(
                         std::thread(&Parser::process_file, this, thread_id));
                 }
 
+                reader.join();
                 for (auto& thread : master_threads) { thread.join(); }
+
+                // All the paragraphs were received
+                processed_queue.close();
+                if (writer.joinable()) { writer.join(); }
+                if (cache) {
+                    cache->close();
+                    cache->report(std::cerr);
+                }
             } break;
-            case NodesType::Horror:
-            case NodesType::Comedy:
-            case NodesType::Fantasy:
-            case NodesType::SciFi: {
+            case NodesType::Worker: {
+                pool = std::make_unique<ThreadPool>(options.threads);
+
                 std::thread comm_thread;
                 comm_thread = std::thread(&Parser::worker_communicator, this);
                 comm_thread.join();
             } break;
         }
+
+        if (options.local) {
+            if (Trace::is_enabled()) { Trace::write(trace_path); }
+            return;
+        }
+
+        if (Trace::is_enabled()) { Trace::gather(worker_rank, trace_path); }
         MPI_Finalize();
     }
 
+    void Parser::read_file() const {
+        Trace::name_thread("reader");
+
+        for (size_t file = 0; file < jobs.size(); ++file) {
+            Job& job = *jobs[file];
+
+            // Wait until a file was completely written, if too many are open
+            {
+                Trace::Scope scope("files_wait");
+                open_files.acquire(1);
+            }
+            job.input = std::make_unique<InputFile>(job.input_path);
+            Conditions::MUST(job.input->is_open(),
+                             to_string(node_type) + ": " + job.input_path +
+                                 ": Input file could not be opened\n");
+            job.output = std::make_unique<OutputFile>(job.output_path,
+                                                      options.pwrite);
+            Conditions::MUST(job.output->is_open(),
+                             to_string(node_type) + ": " + job.output_path +
+                                 ": Output file could not be created\n");
+
+            // The paragraphs of a large file are found in parallel
+            {
+                Trace::Scope scope("index");
+                job.input->index(options.scan_threads);
+            }
+
+            // Read all the file, ignoring invalid paragraphs
+            Paragraph paragraph;
+            size_t sequence = 0;
+            size_t output_size = 0;
+            while (true) {
+                {
+                    Trace::Scope scope("read");
+                    if (!job.input->next(paragraph)) { break; }
+                    scope.add_bytes(paragraph.size);
+                }
+
+                // Found a valid paragraph, store its position in the output
+                paragraph.file = file;
+                paragraph.sequence = sequence++;
+
+                // A single process has no other workers to share a paragraph
+                // with
+                size_t split_bytes =
+                    options.local ? SIZE_MAX : (size_t)options.split_bytes;
+                auto parts =
+                    job.input->split(std::move(paragraph), split_bytes);
+
+                // A paragraph is only split between lines, so a part with a
+                // huge line can still be too large for a message
+                for (auto& part : parts) {
+                    Conditions::MUST(
+                        options.local ||
+                            part.header.size() + part.size <=
+                                Constants::MAX_PARAGRAPH_BYTES,
+                        to_string(node_type) + ": " + job.input_path +
+                            ": Paragraph " + std::to_string(part.sequence) +
+                            " has a line too large to be sent to a worker (" +
+                            std::to_string(part.size) + " bytes)\n");
+                }
+
+                // Wait until enough paragraphs were written. All the parts
+                // are reserved at once, as the paragraph is written only as a
+                // whole
+                size_t size = 0;
+                for (auto& part : parts) { size += footprint(part); }
+                {
+                    Trace::Scope scope("budget_wait");
+                    budget.acquire(size);
+                }
+
+                // The offsets of the processed parts, after the ones before
+                // them
+                if (options.pwrite) {
+                    Trace::Scope scope("output_size");
+                    for (auto& part : parts) {
+                        if (part.part == 0 && part.sequence != 0) {
+                            output_size++;
+                        }
+                        part.output_offset = output_size;
+                        part.output_size = processed_size(part);
+                        output_size += part.output_size;
+                        scope.add_bytes(part.size);
+                    }
+                }
+
+                job.unfinished += parts.size();
+                for (auto& part : parts) {
+                    size_t worker =
+                        scheduler.assign(part.header.size() + part.size);
+                    paragraph_queues[worker]->push(std::move(part));
+                }
+            }
+
+            if (options.pwrite) { job.output->resize(output_size); }
+            finish(job, 1);
+        }
+
+        // Let the senders know that there are no more paragraphs
+        for (auto& queue : paragraph_queues) { queue->close(); }
+    }
+
     void Parser::process_file(const int thread_id) const {
         int worker_id = thread_id + 1;
-        Enums::GenresType p_type = static_cast<Enums::GenresType>(thread_id);
-        std::string genre = Enums::to_string(p_type);
-        std::queue<std::string> recv_paragraphs;
-
-        std::ifstream input(input_path);
-        Conditions::MUST(
-            input.is_open(),
-            to_string(node_type) + ": Input file could not be opened\n");
-
-        // Read all the file, ignoring invalid paragraphs
-        std::stringstream paragraph;
-        std::string line;
-        while (!input.eof()) {
-            std::getline(input, line);
-
-            // Store the initial order of the paragraphs
-            if (thread_id == 0) {
-                using namespace Enums;
-                if (line == to_string(GenresType::Horror)) {
-                    output_order.push_back((int)GenresType::Horror);
-                } else if (line == to_string(GenresType::Comedy)) {
-                    output_order.push_back((int)GenresType::Comedy);
-                } else if (line == to_string(GenresType::Fantasy)) {
-                    output_order.push_back((int)GenresType::Fantasy);
-                } else if (line == to_string(GenresType::SciFi)) {
-                    output_order.push_back((int)GenresType::SciFi);
+        Trace::name_thread("sender-" + std::to_string(worker_id));
+
+        // A batch of paragraphs. It is kept until it is received back
+        struct Pending {
+            std::vector<Paragraph> paragraphs;
+            std::vector<CacheKey> keys;
+            Batch::Header header;
+            Codec::Envelope envelope;
+            std::vector<char> compressed;
+            std::vector<char> processed;
+            MPI_Request requests[2];
+        };
+        std::deque<Pending> in_flight;
+        Pending batch;
+        bool closed = false;
+        int sequence = 0;
+
+        Codec::Encoder encoder(options.compress, options.compress_threshold,
+                               bandwidths.empty() ? 0 : bandwidths[thread_id]);
+        size_t envelope_size = Codec::envelope_size(options.compress);
+        std::vector<char> packed, decompressed;
+        Placement placement;
+
+        while (true) {
+            // Add paragraphs to the next batch, until it is full. Only wait
+            // for the reader if there is nothing else to do
+            while (!closed && !is_full(batch.header)) {
+                Paragraph paragraph;
+                if (in_flight.empty() && batch.paragraphs.empty()) {
+                    Trace::Scope scope("queue_wait");
+                    if (!paragraph_queues[thread_id]->pop(paragraph)) {
+                        closed = true;
+                        break;
+                    }
+                } else if (!paragraph_queues[thread_id]->try_pop(paragraph)) {
+                    break;
+                }
+
+                // The paragraphs that were processed before are not sent
+                if (cache) {
+                    CacheKey key;
+                    if (find_cached(thread_id, paragraph, key)) { continue; }
+                    batch.keys.push_back(key);
                 }
+
+                batch.header.add(paragraph.header.size() + paragraph.size);
+                batch.paragraphs.push_back(std::move(paragraph));
             }
 
-            // Found a valid paragraph
-            if (line == genre) {
-                while (line != "" && !input.eof()) {
-                    paragraph << line << "\n";
-                    std::getline(input, line);
+            // Send the batch if it is full, or if the worker would be idle
+            bool ready = !batch.paragraphs.empty() &&
+                         (is_full(batch.header) || in_flight.empty() || closed);
+
+            if (ready && (int)in_flight.size() < options.window) {
+                // A processed paragraph is at most twice as large (the
+                // consonants are doubled), plus a newline
+                size_t bound = 0;
+                for (auto& paragraph : batch.paragraphs) {
+                    bound += 2 * (paragraph.header.size() + paragraph.size) + 1;
                 }
+                batch.processed.resize(
+                    envelope_size +
+                    Batch::header_size(batch.paragraphs.size()) + bound);
 
-                if (input.eof()) { paragraph << line << "\n"; }
-                std::string data = paragraph.str();
+                int tag = sequence % Constants::MAX_TAG;
+                sequence++;
 
-                // Send the processed paragraph
-                MPI_Send(data.c_str(), data.length(), MPI_CHAR, worker_id, 0,
-                         MPI_COMM_WORLD);
+                in_flight.push_back(std::move(batch));
+                batch = Pending();
+                Pending& sent = in_flight.back();
 
-                // Receive the processed paragraph
-                int p_size;
-                MPI_Status status;
-                MPI_Probe(worker_id, 0, MPI_COMM_WORLD, &status);
-                MPI_Get_count(&status, MPI_CHAR, &p_size);
+                // Send the header and the paragraphs as a single message,
+                // straight from the input data, unless it is compressed
+                size_t size = sent.header.size() + sent.header.payload_size();
+                bool compressed = false;
+                if (encoder.should_compress(size)) {
+                    pack_batch(sent.header, sent.paragraphs, packed);
+                    compressed = encoder.compress(packed.data(), packed.size(),
+                                                  sent.compressed);
+                }
 
-                char* processed_par = (char*)malloc(sizeof(char) * p_size);
+                Trace::Scope scope("send", size);
+                if (compressed) {
+                    MPI_Isend(sent.compressed.data(), sent.compressed.size(),
+                              MPI_CHAR, worker_id, tag, MPI_COMM_WORLD,
+                              &sent.requests[0]);
+                } else {
+                    sent.envelope = Codec::make_envelope(0, size);
+                    MPI_Datatype type =
+                        batch_type(envelope_size != 0 ? &sent.envelope
+                                                      : nullptr,
+                                   sent.header, sent.paragraphs);
+                    MPI_Isend(MPI_BOTTOM, 1, type, worker_id, tag,
+                              MPI_COMM_WORLD, &sent.requests[0]);
+                    MPI_Type_free(&type);
+                }
 
-                MPI_Recv(processed_par, p_size, MPI_CHAR, worker_id, 0,
-                         MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                MPI_Irecv(sent.processed.data(), sent.processed.size(),
+                          MPI_CHAR, worker_id, tag, MPI_COMM_WORLD,
+                          &sent.requests[1]);
+                continue;
+            }
 
-                processed_par[p_size - 1] = '\0';
+            // No paragraphs left
+            if (in_flight.empty()) { break; }
 
-                // Store paragraph
-                recv_paragraphs.push(std::string(processed_par));
+            // Receive the oldest batch
+            Pending& oldest = in_flight.front();
+            MPI_Status statuses[2];
+            int p_size;
+            {
+                Trace::Scope scope("reply_wait");
+                MPI_Waitall(2, oldest.requests, statuses);
+                MPI_Get_count(&statuses[1], MPI_CHAR, &p_size);
+                scope.add_bytes(p_size);
+            }
 
-                // Prepare next paragraph
-                free(processed_par);
-                paragraph.str("");
-                paragraph.clear();
+            // Pass the processed paragraphs to the writer
+            std::string_view reply =
+                unwrap(oldest.processed.data(), p_size, decompressed);
+            Batch::View processed(reply.data(), reply.size());
+            for (size_t i = 0; i < processed.count(); ++i) {
+                std::string_view data = processed[i];
+                if (cache) {
+                    Trace::Scope scope("cache_insert", data.size());
+                    cache->insert(oldest.keys[i], data);
+                }
+                deliver(thread_id, oldest.paragraphs[i], data, placement);
             }
+
+            // The reply buffer is reused by the next batch
+            flush(placement);
+            in_flight.pop_front();
         }
-        input.close();
 
         // Send EOF
         MPI_Send(nullptr, 0, MPI_CHAR, worker_id, 0, MPI_COMM_WORLD);
+    }
 
-        // Print processed paragraphs
-        std::ofstream out;
+    void Parser::process_local() const {
+        Trace::name_thread("processor");
 
-        for (unsigned int i = 0; i < output_order.size(); ++i) {
-            if (thread_id == 0) {
-                current_out_type =
-                    static_cast<Enums::GenresType>(output_order[i]);
+        // The paragraphs are whole, as they aren't split in local mode.
+        // The ones that are already read are processed together, as a batch
+        std::vector<Paragraph> paragraphs;
+        std::vector<std::string_view> raw;
+        std::vector<CacheKey> keys;
+        Placement placement;
+        Arena arena;
+
+        while (true) {
+            Paragraph paragraph;
+            {
+                Trace::Scope scope("queue_wait");
+                if (!paragraph_queues[0]->pop(paragraph)) { break; }
             }
 
-            pthread_barrier_wait(&barrier);
+            paragraphs.clear();
+            raw.clear();
+            keys.clear();
+            do {
+                // The paragraphs that were processed before are skipped
+                if (cache) {
+                    CacheKey key;
+                    if (find_cached(0, paragraph, key)) { continue; }
+                    keys.push_back(key);
+                }
 
-            if (!recv_paragraphs.empty()) {
-                std::string p = recv_paragraphs.front();
+                raw.emplace_back(paragraph.data, paragraph.size);
+                paragraphs.push_back(std::move(paragraph));
+            } while ((int)paragraphs.size() < options.batch_count &&
+                     paragraph_queues[0]->try_pop(paragraph));
+            if (paragraphs.empty()) { continue; }
 
-                // Check type of the paragraph
-                std::stringstream par(p);
-                std::string type;
-                par >> type;
+            Trace::Scope scope("process");
+            process_paragraphs(raw, 0, arena);
 
-                if (type == Enums::to_string(current_out_type)) {
-                    if (!output_created) {
-                        out.open(output_path);
-                        output_created = true;
-                    } else {
-                        out.open(output_path, std::ios::app);
-                    }
-                    out << p;
-                    if (i != output_order.size() - 1) { out << "\n"; }
-                    recv_paragraphs.pop();
-                    out.close();
+            for (size_t i = 0; i < paragraphs.size(); ++i) {
+                const ParagraphIndex& index = arena.paragraphs[i];
+                std::string_view data(arena.output.data() + index.output,
+                                      index.output_size);
+                if (cache) {
+                    Trace::Scope scope("cache_insert", data.size());
+                    cache->insert(keys[i], data);
                 }
+                deliver(0, paragraphs[i], data, placement);
+                scope.add_bytes(paragraphs[i].size);
             }
 
-            pthread_barrier_wait(&barrier);
+            // The arena is reused by the next batch
+            flush(placement);
         }
     }
 
-    void Parser::worker_communicator() const {
-        int max_threads = std::thread::hardware_concurrency() - 1;
-        bool eof = false;
+    void Parser::finish(Job& job, size_t parts) const {
+        if ((job.unfinished -= parts) != 0) { return; }
 
-        while (!eof) {
-            // Receive paragraph
-            int p_size;
-            MPI_Status status;
-            MPI_Probe(Constants::MASTER, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
-            MPI_Get_count(&status, MPI_CHAR, &p_size);
+        job.output->close();
+        job.output.reset();
+        job.input.reset();
+        open_files.release(1);
+    }
 
-            char* raw_paragraph = (char*)malloc(sizeof(char) * p_size);
+    bool Parser::find_cached(const int thread_id, const Paragraph& paragraph,
+                             CacheKey& key) const {
+        Trace::Scope scope("cache_lookup", paragraph.header.size() +
+                                               paragraph.size);
+        Hasher hasher;
+        hasher.update(paragraph.header.data(), paragraph.header.size());
+        hasher.update(paragraph.data, paragraph.size);
+        key = hasher.finish();
 
-            MPI_Recv(raw_paragraph, p_size, MPI_CHAR, Constants::MASTER,
-                     MPI_ANY_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        std::string data;
+        if (!cache->find(key, data)) { return false; }
 
-            raw_paragraph[p_size - 1] = '\0';
+        Placement placement;
+        deliver(thread_id, paragraph, data, placement);
+        flush(placement);
+        return true;
+    }
 
-            if (p_size == 0) {
-                eof = true;
-            } else {
-                std::string type, line;
-                std::stringstream p(raw_paragraph);
-                std::vector<std::string> content;
-
-                // Get the number of lines in the paragraph
-                p >> type;
-                while (!p.eof()) {
-                    std::getline(p, line);
-                    if (line.size() != 0) { content.push_back(line); }
-                }
+    void Parser::deliver(const int thread_id, const Paragraph& paragraph,
+                         std::string_view data, Placement& placement) const {
+        // Only the first part of a paragraph keeps the header line
+        if (paragraph.part != 0) { data.remove_prefix(data.find('\n') + 1); }
+        scheduler.complete(thread_id,
+                           paragraph.header.size() + paragraph.size);
 
-                // Process the paragraph in multiple threads
-                int total_runs =
-                    (int)content.size() / Constants::LINES_PER_THREAD + 1;
-                total_runs = std::max(1, total_runs);
+        // The input is not needed anymore. It must be released before the
+        // paragraph is written, as the file is closed after that
+        Job& job = *jobs[paragraph.file];
+        if (budget.is_limited()) { job.input->release(paragraph); }
 
-                int remaining_runs = total_runs;
-                int start = 0, end = Constants::LINES_PER_THREAD;
+        if (!options.pwrite) {
+            processed_queue.push({paragraph.file, paragraph.sequence,
+                                  paragraph.part, paragraph.parts,
+                                  std::string(data), footprint(paragraph)});
+            return;
+        }
 
-                // Run the maximum allowed number of threads until all lines
-                // are processed
-                while (remaining_runs > 0) {
-                    int t_count = std::min(remaining_runs, max_threads);
-                    t_count = std::max(1, t_count);
-                    std::vector<std::thread> processors(t_count);
+        // The paragraphs of a file are written together
+        if (placement.file != paragraph.file) { flush(placement); }
+        placement.file = paragraph.file;
+        placement.paragraphs.push_back(placed(paragraph, data));
+        placement.footprint += footprint(paragraph);
+    }
 
-                    // Init threads
-                    for (int id = 0; id < t_count; ++id) {
-                        Enums::GenresType t_type =
-                            static_cast<Enums::GenresType>(worker_rank - 1);
+    void Parser::flush(Placement& placement) const {
+        if (placement.paragraphs.empty()) { return; }
 
-                        start = std::min(start, (int)content.size());
-                        end = std::min(end, (int)content.size());
+        Trace::Scope scope("write");
+        for (auto& paragraph : placement.paragraphs) {
+            scope.add_bytes(paragraph.data.size());
+        }
+        jobs[placement.file]->output->write_at(placement.paragraphs);
+        finish(*jobs[placement.file], placement.paragraphs.size());
+        budget.release(placement.footprint);
+        placement.paragraphs.clear();
+        placement.footprint = 0;
+    }
 
-                        processors.push_back(
-                            std::thread(&Parser::process_lines, this,
-                                        std::ref(content), start, end, t_type));
+    void Parser::write_file() const {
+        Trace::name_thread("writer");
 
-                        start += Constants::LINES_PER_THREAD;
-                        end += Constants::LINES_PER_THREAD;
-                    }
+        Processed paragraph;
+        while (true) {
+            {
+                Trace::Scope scope("queue_wait");
+                if (!processed_queue.pop(paragraph)) { break; }
+            }
 
-                    for (auto& thread : processors) {
-                        if (thread.joinable()) { thread.join(); }
-                    }
+            Trace::Scope scope("write", paragraph.data.size());
+            Job& job = *jobs[paragraph.file];
+            size_t written = job.output->written();
+            budget.release(job.output->write(std::move(paragraph)));
+            finish(job, job.output->written() - written);
+        }
+    }
 
-                    remaining_runs -= max_threads;
-                }
+    bool Parser::is_full(const Batch::Header& header) const {
+        return (int)header.count() >= options.batch_count ||
+               (long)header.payload_size() >= options.batch_bytes;
+    }
 
-                // // Single-Threaded Processing
-                // Enums::GenresType p_type =
-                //     static_cast<Enums::GenresType>(worker_rank - 1);
-                // process_lines(content, 0, content.size(), p_type);
+    MPI_Datatype Parser::batch_type(
+        const Codec::Envelope* envelope, const Batch::Header& header,
+        const std::vector<Paragraph>& paragraphs) const {
+        std::vector<int> lengths;
+        std::vector<MPI_Aint> addresses;
 
-                // Get the processed paragraph data
-                std::stringstream ss;
-                ss << type << "\n";
-                for (auto& line : content) { ss << line << "\n"; }
+        auto add_block = [&](const char* data, size_t size) {
+            MPI_Aint address;
+            MPI_Get_address(data, &address);
+            lengths.push_back(size);
+            addresses.push_back(address);
+        };
 
-                std::string data = ss.str();
+        if (envelope != nullptr) {
+            add_block(reinterpret_cast<const char*>(envelope),
+                      sizeof(*envelope));
+        }
+        add_block(header.data(), header.size());
+        for (auto& paragraph : paragraphs) {
+            // The header line of a part is separate from its lines
+            if (!paragraph.header.empty()) {
+                add_block(paragraph.header.data(), paragraph.header.size());
+            }
+            add_block(paragraph.data, paragraph.size);
+        }
+
+        MPI_Datatype type;
+        MPI_Type_create_hindexed(lengths.size(), lengths.data(),
+                                 addresses.data(), MPI_CHAR, &type);
+        MPI_Type_commit(&type);
+        return type;
+    }
 
-                // Send the processed paragraph
-                MPI_Send(data.c_str(), data.length() + 1, MPI_CHAR,
-                         Constants::MASTER, status.MPI_TAG, MPI_COMM_WORLD);
+    void Parser::pack_batch(const Batch::Header& header,
+                            const std::vector<Paragraph>& paragraphs,
+                            std::vector<char>& packed) const {
+        packed.assign(header.data(), header.data() + header.size());
+        for (auto& paragraph : paragraphs) {
+            packed.insert(packed.end(), paragraph.header.begin(),
+                          paragraph.header.end());
+            packed.insert(packed.end(), paragraph.data,
+                          paragraph.data + paragraph.size);
+        }
+    }
 
-                free(raw_paragraph);
+    void Parser::measure_bandwidth() {
+        std::vector<char> probe(Constants::BANDWIDTH_PROBE_BYTES);
+
+        if (node_type == Enums::NodesType::Master) {
+            // The fastest of a few round trips, with a large message one way
+            // and an empty one back
+            for (int worker = 1; worker < worker_count; ++worker) {
+                uint64_t best = UINT64_MAX;
+                for (int i = 0; i < Constants::BANDWIDTH_PROBES; ++i) {
+                    uint64_t start = Trace::now();
+                    MPI_Send(probe.data(), probe.size(), MPI_CHAR, worker, 0,
+                             MPI_COMM_WORLD);
+                    MPI_Recv(nullptr, 0, MPI_CHAR, worker, 0, MPI_COMM_WORLD,
+                             MPI_STATUS_IGNORE);
+                    best = std::min(best, Trace::now() - start);
+                }
+
+                double bandwidth =
+                    (double)probe.size() / std::max<uint64_t>(best, 1);
+                bandwidths.push_back(bandwidth);
+                MPI_Send(&bandwidth, 1, MPI_DOUBLE, worker, 0, MPI_COMM_WORLD);
+            }
+        } else {
+            for (int i = 0; i < Constants::BANDWIDTH_PROBES; ++i) {
+                MPI_Recv(probe.data(), probe.size(), MPI_CHAR,
+                         Constants::MASTER, 0, MPI_COMM_WORLD,
+                         MPI_STATUS_IGNORE);
+                MPI_Send(nullptr, 0, MPI_CHAR, Constants::MASTER, 0,
+                         MPI_COMM_WORLD);
             }
+
+            bandwidths.resize(1);
+            MPI_Recv(bandwidths.data(), 1, MPI_DOUBLE, Constants::MASTER, 0,
+                     MPI_COMM_WORLD, MPI_STATUS_IGNORE);
         }
     }
 
-    void Parser::process_lines(std::vector<std::string>& lines, int start,
-                               int end, Enums::GenresType type) const {
-        using namespace Enums;
+    std::string_view Parser::unwrap(const char* message, size_t size,
+                                    std::vector<char>& buffer) const {
+        if (options.compress == Codec::Mode::Off) {
+            return std::string_view(message, size);
+        }
+        return Codec::decode(message, size, buffer);
+    }
 
-        switch (type) {
-            case GenresType::Horror: {
-                for (int i = start; i < end; ++i) {
-                    std::stringstream line(lines[i]);
-                    std::string word;
-                    std::string result = "";
-
-                    while (std::getline(line, word, ' ')) {
-                        for (unsigned int lcount = 0; lcount < word.size();
-                             ++lcount) {
-                            result += word.at(lcount);
-                            if (Utilities::is_consonant(word.at(lcount))) {
-                                result += std::tolower(word.at(lcount));
-                            }
-                        }
-                        result += ' ';
-                    }
-                    result.pop_back();
+    void Parser::worker_communicator() const {
+        Trace::name_thread("communicator");
+        std::vector<WorkerBuffer> buffers(options.buffers);
+        Codec::Encoder encoder(options.compress, options.compress_threshold,
+                               bandwidths.empty() ? 0 : bandwidths[0]);
+        size_t envelope_size = Codec::envelope_size(options.compress);
+
+        // The buffers from current to current + posted - 1 (in the ring) have
+        // a batch, received or being received
+        size_t current = 0, posted = 0;
+        bool eof = false;
 
-                    lines[i] = result;
+        // Start receiving the batches that already arrived, in the next free
+        // buffers. If no batch is received, wait for one
+        auto post_receives = [&](bool block) {
+            while (posted < buffers.size() && !eof) {
+                MPI_Message message;
+                MPI_Status status;
+                int flag = 1;
+
+                if (block && posted == 0) {
+                    Trace::Scope scope("probe");
+                    MPI_Mprobe(Constants::MASTER, MPI_ANY_TAG, MPI_COMM_WORLD,
+                               &message, &status);
+                } else {
+                    MPI_Improbe(Constants::MASTER, MPI_ANY_TAG, MPI_COMM_WORLD,
+                                &flag, &message, &status);
+                    if (!flag) { return; }
                 }
-            } break;
-            case GenresType::Comedy: {
-                for (int i = start; i < end; ++i) {
-                    std::stringstream line(lines[i]);
-                    std::string result = "";
-                    std::string word;
-
-                    while (std::getline(line, word, ' ')) {
-                        for (unsigned int lcount = 0; lcount < word.size();
-                             ++lcount) {
-                            if (lcount % 2 == 1) {
-                                result += std::toupper(word.at(lcount));
-                            } else {
-                                result += word.at(lcount);
-                            }
-                        }
-                        result += ' ';
-                    }
 
-                    result.pop_back();
-                    lines[i] = result;
+                WorkerBuffer& buffer =
+                    buffers[(current + posted) % buffers.size()];
+                MPI_Get_count(&status, MPI_CHAR, &buffer.size);
+                buffer.tag = status.MPI_TAG;
+                buffer.message.resize(buffer.size);
+                MPI_Imrecv(buffer.message.data(), buffer.size, MPI_CHAR,
+                           &message, &buffer.receive);
+
+                eof = buffer.size == 0;
+                posted++;
+            }
+        };
+
+        // Called between the tasks, so the transfers progress while a batch
+        // is processed
+        auto progress = [&] {
+            post_receives(false);
+
+            int flag;
+            for (auto& buffer : buffers) {
+                MPI_Test(&buffer.receive, &flag, MPI_STATUS_IGNORE);
+                MPI_Test(&buffer.reply, &flag, MPI_STATUS_IGNORE);
+            }
+        };
+
+        while (true) {
+            post_receives(true);
+
+            WorkerBuffer& buffer = buffers[current];
+            {
+                Trace::Scope scope("receive", buffer.size);
+                MPI_Wait(&buffer.receive, MPI_STATUS_IGNORE);
+            }
+            if (buffer.size == 0) { break; }
+
+            // The arena of the buffer is reused, after its reply was sent
+            {
+                Trace::Scope scope("reply_wait");
+                MPI_Wait(&buffer.reply, MPI_STATUS_IGNORE);
+            }
+
+            std::string_view received = unwrap(
+                buffer.message.data(), buffer.size, buffer.decompressed);
+            Batch::View batch(received.data(), received.size());
+            Arena& arena = buffer.arena;
+            {
+                Trace::Scope scope("process", buffer.size);
+                buffer.raw.clear();
+                for (size_t i = 0; i < batch.count(); ++i) {
+                    buffer.raw.push_back(batch[i]);
                 }
-            } break;
-            case GenresType::Fantasy: {
-                for (int i = start; i < end; ++i) {
-                    std::stringstream line(lines[i]);
-                    std::string result = "";
-                    std::string word;
-
-                    while (std::getline(line, word, ' ')) {
-                        word[0] = std::toupper(word[0]);
-                        result += word + " ";
-                    }
 
-                    result.pop_back();
-                    lines[i] = result;
+                // The processed paragraphs are written after the envelope
+                // and the header of the reply
+                process_paragraphs(
+                    buffer.raw,
+                    envelope_size + Batch::header_size(batch.count()), arena,
+                    progress);
+
+                Batch::Header header;
+                for (auto& paragraph : arena.paragraphs) {
+                    header.add(paragraph.output_size);
                 }
-            } break;
-            case GenresType::SciFi: {
-                for (int i = start; i < end; ++i) {
-                    std::stringstream line(lines[i]);
-                    std::string result = "";
-                    std::string word;
-                    int word_counter = 0;
-
-                    while (std::getline(line, word, ' ')) {
-                        word_counter++;
-                        if (word_counter == 7) {
-                            word_counter = 0;
-                            std::reverse(word.begin(), word.end());
-                        }
+                std::memcpy(arena.output.data() + envelope_size, header.data(),
+                            header.size());
+            }
 
-                        result += word + " ";
-                    }
+            // The reply is sent straight from the arena, unless it is
+            // compressed
+            const char* reply = arena.output.data();
+            size_t reply_size = arena.output.size();
+            if (envelope_size != 0) {
+                const char* data = reply + envelope_size;
+                size_t size = reply_size - envelope_size;
 
-                    result.pop_back();
-                    lines[i] = result;
+                if (encoder.should_compress(size) &&
+                    encoder.compress(data, size, buffer.compressed)) {
+                    reply = buffer.compressed.data();
+                    reply_size = buffer.compressed.size();
+                } else {
+                    Codec::Envelope envelope = Codec::make_envelope(0, size);
+                    std::memcpy(arena.output.data(), &envelope,
+                                envelope_size);
                 }
-            } break;
+            }
+
+            // Send the processed batch while the next one is processed
+            {
+                Trace::Scope scope("reply", reply_size);
+                MPI_Isend(reply, reply_size, MPI_CHAR, Constants::MASTER,
+                          buffer.tag, MPI_COMM_WORLD, &buffer.reply);
+            }
+
+            current = (current + 1) % buffers.size();
+            posted--;
+        }
+
+        // The last replies
+        Trace::Scope scope("reply_wait");
+        for (auto& buffer : buffers) {
+            MPI_Wait(&buffer.reply, MPI_STATUS_IGNORE);
+        }
+    }
+
+    void Parser::index_paragraph(std::string_view raw, Arena& arena) const {
+        const char* line = raw.data();
+        const char* end = raw.data() + raw.size();
+        const char* newline = (const char*)std::memchr(line, '\n', raw.size());
+        const char* stop = newline != nullptr ? newline : end;
+
+        // The header line gives the genre
+        ParagraphIndex paragraph;
+        std::string_view header(line, stop - line);
+        Conditions::MUST(Genres::find(header, paragraph.type),
+                         to_string(node_type) + ": Unknown genre \"" +
+                             std::string(header) + "\"\n");
+
+        // Use at least a task for each thread, unless they would be too small
+        paragraph.task_size = std::min(
+            task_sizer.bytes(),
+            std::max(Constants::MIN_TASK_BYTES, raw.size() / options.threads));
+        paragraph.first_piece = arena.pieces.size();
+
+        // The non-empty lines, or their pieces
+        for (line = stop + 1; line < end; line = stop + 1) {
+            newline = (const char*)std::memchr(line, '\n', end - line);
+            stop = newline != nullptr ? newline : end;
+            size_t size = stop - line;
+
+            if (size == 0) { continue; }
+            if (options.split_lines && size > paragraph.task_size) {
+                split_line(line, size, paragraph.task_size, arena.pieces);
+            } else {
+                arena.pieces.push_back({line, size});
+            }
+        }
+
+        paragraph.end_piece = arena.pieces.size();
+        arena.paragraphs.push_back(paragraph);
+    }
+
+    template <typename Task>
+    void Parser::submit_tasks(const Arena& arena,
+                              const ParagraphIndex& paragraph,
+                              Task task) const {
+        size_t start = paragraph.first_piece, size = 0;
+        for (size_t end = start + 1; end <= paragraph.end_piece; ++end) {
+            size += arena.pieces[end - 1].size;
+            if (size < paragraph.task_size && end != paragraph.end_piece) {
+                continue;
+            }
+
+            pool->submit([task, start, end, size] { task(start, end, size); });
+            start = end;
+            size = 0;
+        }
+    }
+
+    template <typename Genre, typename Set>
+    void Parser::measure_lines(Arena& arena, size_t start, size_t end) const {
+        for (size_t i = start; i < end; ++i) {
+            LinePiece& piece = arena.pieces[i];
+            piece.output_size =
+                Genre::template output_size<Set>(piece.data, piece.size);
+        }
+    }
+
+    template <typename Genre, typename Set>
+    void Parser::process_lines(Arena& arena, size_t start, size_t end) const {
+        for (size_t i = start; i < end; ++i) {
+            const LinePiece& piece = arena.pieces[i];
+            char* out = arena.output.data() + piece.output;
+
+            // The newline is written after the line, as the transformation
+            // can use its byte
+            Genre::template transform<Set>(piece.data, piece.size, out,
+                                           piece.first_word);
+            if (piece.last) { out[piece.output_size] = '\n'; }
+        }
+    }
+
+    void Parser::process_paragraphs(
+        const std::vector<std::string_view>& raw, size_t reserved,
+        Arena& arena, const std::function<void()>& progress) const {
+        arena.paragraphs.clear();
+        arena.pieces.clear();
+        for (auto paragraph : raw) { index_paragraph(paragraph, arena); }
+
+        // The lines are transformed with the kernels of the selected level,
+        // chosen once for the whole batch
+        Kernels::visit(Kernels::selected(), [&](auto set) {
+            using Set = decltype(set);
+            process_paragraphs<Set>(reserved, arena, progress);
+        });
+    }
+
+    template <typename Set>
+    void Parser::process_paragraphs(
+        size_t reserved, Arena& arena,
+        const std::function<void()>& progress) const {
+        // The sizes of the processed lines. They are only computed in tasks
+        // for the genres that need a pass over the lines
+        bool measuring = false;
+        for (auto& paragraph : arena.paragraphs) {
+            Genres::Registry::visit(paragraph.type, [&](auto genre) {
+                using Genre = decltype(genre);
+
+                if constexpr (Genre::expands) {
+                    measuring = true;
+                    submit_tasks(arena, paragraph,
+                                 [this, &arena](size_t start, size_t end,
+                                                size_t size) {
+                                     Trace::Scope scope("measure_lines", size);
+                                     measure_lines<Genre, Set>(arena, start,
+                                                               end);
+                                 });
+                } else {
+                    measure_lines<Genre, Set>(arena, paragraph.first_piece,
+                                              paragraph.end_piece);
+                }
+            });
         }
-    }    // namespace GenreParser
+        if (measuring) {
+            Trace::Scope scope("tasks_wait");
+            pool->wait(progress);
+        }
+
+        // The place of each paragraph and line in the output
+        size_t output = reserved;
+        for (auto& paragraph : arena.paragraphs) {
+            paragraph.output = output;
+            output += Genres::header(paragraph.type).size() + 1;
+            for (size_t i = paragraph.first_piece; i < paragraph.end_piece;
+                 ++i) {
+                LinePiece& piece = arena.pieces[i];
+                piece.output = output;
+                output += piece.output_size + (piece.last ? 1 : 0);
+            }
+            paragraph.output_size = output - paragraph.output;
+        }
+        arena.output.resize(output);
+
+        // Write the headers, then process the lines in place
+        for (auto& paragraph : arena.paragraphs) {
+            std::string_view header = Genres::header(paragraph.type);
+            char* out = arena.output.data() + paragraph.output;
+            std::memcpy(out, header.data(), header.size());
+            out[header.size()] = '\n';
+
+            Genres::Registry::visit(paragraph.type, [&](auto genre) {
+                using Genre = decltype(genre);
+
+                submit_tasks(
+                    arena, paragraph,
+                    [this, &arena](size_t start, size_t end, size_t size) {
+                        Trace::Scope scope("process_lines", size);
+                        auto begin = std::chrono::steady_clock::now();
+
+                        process_lines<Genre, Set>(arena, start, end);
+
+                        task_sizer.update(
+                            size, std::chrono::duration_cast<
+                                      std::chrono::nanoseconds>(
+                                      std::chrono::steady_clock::now() - begin)
+                                      .count());
+                    });
+            });
+        }
+        {
+            Trace::Scope scope("tasks_wait");
+            pool->wait(progress);
+        }
+    }
 }    // namespace GenreParser
\ No newline at end of file
@@ -8,30 +8,123 @@
 #pragma once
 
 #include <mpi.h>
-#include <pthread.h>
 
 #include <algorithm>
-#include <fstream>
-#include <queue>
-#include <sstream>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
 #include <thread>
 
+#include "Batch.hpp"
+#include "Budget.hpp"
+#include "Cache.hpp"
+#include "Codec.hpp"
+#include "Genres.hpp"
 #include "Helpers.hpp"
+#include "InputFile.hpp"
+#include "Kernels.hpp"
+#include "Options.hpp"
+#include "OutputFile.hpp"
+#include "Queue.hpp"
+#include "Scheduler.hpp"
+#include "TaskSizer.hpp"
+#include "ThreadPool.hpp"
+#include "Trace.hpp"
 
 namespace GenreParser {
+    /**
+     * @brief A line of a paragraph, or a piece of a long line (that starts
+     * before a space), that is transformed on its own. It points in the
+     * received data, and knows where it is written in the output
+     */
+    struct LinePiece {
+        const char* data;
+        size_t size;
+        size_t first_word = 0;    // The index of its first word in the line
+        bool last = true;         // If it is the end of the line
+        size_t output = 0;
+        size_t output_size = 0;    // Without the newline
+    };
+
+    /**
+     * @brief A paragraph that is processed: its genre, its pieces and where
+     * it is written in the output
+     */
+    struct ParagraphIndex {
+        Enums::GenresType type;
+        size_t first_piece;
+        size_t end_piece;
+        size_t task_size;    // The bytes processed by a task
+        size_t output = 0;
+        size_t output_size = 0;
+    };
+
+    /**
+     * @brief The memory used by a thread to process paragraphs: the index of
+     * the lines and the output buffer. It is reused for all the paragraphs,
+     * so it only allocates memory when it grows
+     */
+    struct Arena {
+        std::vector<ParagraphIndex> paragraphs;
+        std::vector<LinePiece> pieces;
+        std::vector<char> output;
+    };
+
+    /**
+     * @brief An input file and its output file. They are opened by the
+     * reader, and closed after the last paragraph of the input was written,
+     * so the next files can be read while the last paragraphs of a file are
+     * still processed
+     */
+    struct Job {
+        std::string input_path;
+        std::string output_path;
+        std::unique_ptr<InputFile> input;
+        std::unique_ptr<OutputFile> output;
+
+        // The parts that were read, but not written yet, plus one until the
+        // whole file was read
+        std::atomic<size_t> unfinished{1};
+    };
+
+    /**
+     * @brief Processed paragraphs of a file, that are written together (with
+     * --pwrite), and the memory they hold until then
+     */
+    struct Placement {
+        size_t file = 0;
+        std::vector<Placed> paragraphs;
+        size_t footprint = 0;
+    };
+
     class Parser {
        private:
         int worker_rank;
         int worker_count;
-        Enums::NodesType node_type;    // Equivalent to the worker rank
+        Enums::NodesType node_type;
+        Options options;
 
-        std::string input_path;
-        std::string output_path;
-        static Enums::GenresType current_out_type;
-        static pthread_barrier_t barrier;
-        static std::vector<int> output_order;
+        std::string trace_path;
+        std::vector<std::unique_ptr<Job>> jobs;
+        std::unique_ptr<ResultCache> cache;
+        std::unique_ptr<ThreadPool> pool;
+
+        // The bandwidth of the links to the workers (on the master), or to
+        // the master (on a worker), in bytes per nanosecond. Only measured
+        // when the compression is automatic
+        std::vector<double> bandwidths;
 
-        static bool output_created;
+        static std::vector<
+            std::unique_ptr<Utilities::BlockingQueue<Paragraph>>>
+            paragraph_queues;
+        static Utilities::BlockingQueue<Processed> processed_queue;
+        static Utilities::MemoryBudget budget;
+        static Utilities::MemoryBudget open_files;    // Counts files, not bytes
+        static Utilities::Scheduler scheduler;
+        static Utilities::TaskSizer task_sizer;
 
        public:
         Parser(int argc, char* argv[]);
@@ -39,32 +132,205 @@ namespace GenreParser {
         void run();
 
         /**
-         * @brief Multithreaded paragraph reader. It will only process
-         * paragraphs with a specific tag
-         * As there as many threads as paragraph types, we can link the
-         * thread_id to a GenresType
+         * @brief Reads the input files a single time, one after the other,
+         * splitting them into paragraphs. At most options.open_files files
+         * are open (read, but not completely written) at the same time
+         * Each paragraph is numbered and dispatched to the queue of the
+         * worker with the least outstanding bytes
+         * The paragraphs larger than options.split_bytes are split into parts,
+         * that are dispatched separately
+         * When the memory budget is exceeded, the reader waits for the
+         * paragraphs to be written
+         */
+        void read_file() const;
+
+        /**
+         * @brief Mark parts of a file as written. After the last one, the
+         * files of the job are closed
+         * @param job The job
+         * @param parts The number of parts
+         */
+        void finish(Job& job, size_t parts) const;
+
+        /**
+         * @brief Look for a paragraph in the cache. If it is found, it is
+         * passed to the output stage, as if it was received from a worker
+         * @param thread_id The id of the thread that dispatched the paragraph
+         * @param paragraph The paragraph
+         * @param key Where the key of the paragraph is stored
+         * @return true if the paragraph was found
+         */
+        bool find_cached(const int thread_id, const Paragraph& paragraph,
+                         CacheKey& key) const;
+
+        /**
+         * @brief Writes the processed paragraphs to the output file, as soon
+         * as all the paragraphs before them were written
+         */
+        void write_file() const;
+
+        /**
+         * @brief Multithreaded paragraph sender. There is a thread for each
+         * worker, that sends the paragraphs received from the reader. Any
+         * worker can process any paragraph, as it starts with its header
+         * The paragraphs are sent in batches, and up to options.window
+         * batches are sent to the worker before waiting for the first one to
+         * be received back. Each batch is tagged with its sequence number
          * @param thread_id The id of the thread
          */
         void process_file(const int thread_id) const;
 
         /**
-         * @brief Multithreaded paragraph processor. It will process only the
-         * lines linked to it's thread id
-         * @param thread_id The id of the thread
+         * @brief Paragraph processor of the local mode (without MPI). It
+         * processes the paragraphs received from the reader with the thread
+         * pool, as a worker would, and passes them to the writer
+         */
+        void process_local() const;
+
+        /**
+         * @brief Pass a processed paragraph (or part) to the output stage:
+         * the writer, or, with --pwrite, the placement, that is flushed when
+         * a paragraph of another file follows. The same for the paragraphs
+         * received from the workers, processed locally or found in the cache
+         * @param thread_id The id of the thread that dispatched the paragraph
+         * @param paragraph The paragraph
+         * @param data The processed paragraph, with its header line. It must
+         * be valid until the placement is flushed
+         * @param placement The paragraphs that are not written yet
+         */
+        void deliver(const int thread_id, const Paragraph& paragraph,
+                     std::string_view data, Placement& placement) const;
+
+        /**
+         * @brief Write the placed paragraphs (or parts) at their offsets, in
+         * the output of their file, mark them as written and release their
+         * memory
+         * @param placement The paragraphs, that are cleared
          */
-        void process_paragraph(const int thread_id,
-                               const std::vector<std::string> paragraph) const;
+        void flush(Placement& placement) const;
 
+        /**
+         * @brief Check if a batch reached the size or paragraph count limit
+         * @param header The header of the batch
+         */
+        bool is_full(const Batch::Header& header) const;
+
+        /**
+         * @brief Create a datatype that describes a batch message: the header
+         * followed by the paragraphs (wherever they are in memory)
+         * @param envelope The envelope sent before the header, if the
+         * messages have one
+         * @param header The header of the batch
+         * @param paragraphs The paragraphs of the batch
+         * @return The datatype, to be used with MPI_BOTTOM
+         */
+        MPI_Datatype batch_type(const Codec::Envelope* envelope,
+                                const Batch::Header& header,
+                                const std::vector<Paragraph>& paragraphs) const;
+
+        /**
+         * @brief Copy a batch in a single buffer, to be compressed
+         * @param header The header of the batch
+         * @param paragraphs The paragraphs of the batch
+         * @param packed Where the batch is copied
+         */
+        void pack_batch(const Batch::Header& header,
+                        const std::vector<Paragraph>& paragraphs,
+                        std::vector<char>& packed) const;
+
+        /**
+         * @brief Measure the bandwidth of the link between the master and
+         * each worker, with a few large messages. Every node must call it
+         */
+        void measure_bandwidth();
+
+        /**
+         * @brief The data of a received batch, without its envelope (and
+         * decompressed), if the messages have one
+         * @param message The message
+         * @param size The size of the message
+         * @param buffer Where the data is decompressed
+         */
+        std::string_view unwrap(const char* message, size_t size,
+                                std::vector<char>& buffer) const;
+
+        /**
+         * @brief Receives batches of paragraphs from the master, processes
+         * them and sends them back, as a single batch, until EOF is received
+         */
         void worker_communicator() const;
 
         /**
-         * @brief Process the specified lines, according to the paragraph type
-         * @param lines The lines of the paragraph
+         * @brief Add a paragraph, and the index of its lines, to the arena.
+         * With options.split_lines, the lines longer than a task are split
+         * @param raw The paragraph, including the header line, that gives
+         * its genre
+         * @param arena The arena
+         */
+        void index_paragraph(std::string_view raw, Arena& arena) const;
+
+        /**
+         * @brief Split the pieces of a paragraph in tasks of about
+         * paragraph.task_size bytes, and submit them to the thread pool
+         * @param arena The arena
+         * @param paragraph The paragraph
+         * @param task The task, called with the range of the pieces and their
+         * size
+         */
+        template <typename Task>
+        void submit_tasks(const Arena& arena, const ParagraphIndex& paragraph,
+                          Task task) const;
+
+        /**
+         * @brief Multithreaded paragraph processor. The paragraphs are indexed
+         * first, then the sizes of the processed lines are computed, so each
+         * line has its place in the output. Then, the lines are processed in
+         * tasks of about task_sizer.bytes() bytes (and in at least one task
+         * per thread, if a paragraph is large enough), that are run by the
+         * thread pool and write the lines straight in the output
+         * @param raw The paragraphs, each including its header line
+         * @param reserved The bytes at the start of the output, before the
+         * paragraphs (for the header of a batch)
+         * @param arena The arena, where the paragraphs are written, in order
+         * @param progress Called while waiting for the tasks (see
+         * ThreadPool::wait)
+         */
+        void process_paragraphs(
+            const std::vector<std::string_view>& raw, size_t reserved,
+            Arena& arena,
+            const std::function<void()>& progress = nullptr) const;
+
+        /**
+         * @brief The paragraph processor, after the paragraphs are indexed,
+         * instantiated for the kernels of each level
+         * @tparam Set The kernels (Kernels::Scalar, SSE42 or AVX2)
+         */
+        template <typename Set>
+        void process_paragraphs(size_t reserved, Arena& arena,
+                                const std::function<void()>& progress) const;
+
+        /**
+         * @brief Compute the size of the specified processed lines, with a
+         * genre (instantiated for each genre of Genres::Registry)
+         * @tparam Genre The genre policy
+         * @tparam Set The kernels used by the genre
+         * @param arena The arena that has the lines
+         * @param start The start index
+         * @param end The end index
+         */
+        template <typename Genre, typename Set>
+        void measure_lines(Arena& arena, size_t start, size_t end) const;
+
+        /**
+         * @brief Process the specified lines, with the transformation of a
+         * genre, writing them in the output of the arena
+         * @tparam Genre The genre policy
+         * @tparam Set The kernels used by the genre
+         * @param arena The arena that has the lines
          * @param start The start index
          * @param end The end index
-         * @param type The paragraph type
          */
-        void process_lines(std::vector<std::string>& lines, int start, int end,
-                           Enums::GenresType type) const;
+        template <typename Genre, typename Set>
+        void process_lines(Arena& arena, size_t start, size_t end) const;
     };
 }    // namespace GenreParser
\ No newline at end of file
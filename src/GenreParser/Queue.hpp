@@ -0,0 +1,86 @@
+/**
+ * @file Queue.hpp
+ * @author Grama Nicolae (gramanicu@gmail.com)
+ * @brief Thread-safe queue used to pass data between the master threads
+ * @copyright Copyright (c) 2020
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <queue>
+
+namespace GenreParser::Utilities {
+    /**
+     * @brief Unbounded multi-producer, multi-consumer queue. Consumers block
+     * until an element is available or the queue is closed
+     * @tparam T The type of the stored elements
+     */
+    template <typename T>
+    class BlockingQueue {
+       private:
+        std::queue<T> elements;
+        std::mutex mutex;
+        std::condition_variable available;
+        bool closed = false;
+
+       public:
+        /**
+         * @brief Add an element to the queue and wake up a consumer
+         * @param element The element to be added
+         */
+        void push(T element) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                elements.push(std::move(element));
+            }
+            available.notify_one();
+        }
+
+        /**
+         * @brief Remove the first element of the queue, waiting for one if the
+         * queue is empty
+         * @param element Where the element will be stored
+         * @return false if the queue was closed and there are no more
+         * elements, true otherwise
+         */
+        bool pop(T& element) {
+            std::unique_lock<std::mutex> lock(mutex);
+            available.wait(lock,
+                           [this] { return closed || !elements.empty(); });
+
+            if (elements.empty()) { return false; }
+            element = std::move(elements.front());
+            elements.pop();
+            return true;
+        }
+
+        /**
+         * @brief Remove the first element of the queue, if there is one,
+         * without waiting
+         * @param element Where the element will be stored
+         * @return true if an element was removed, false otherwise
+         */
+        bool try_pop(T& element) {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            if (elements.empty()) { return false; }
+            element = std::move(elements.front());
+            elements.pop();
+            return true;
+        }
+
+        /**
+         * @brief Mark that no more elements will be added. The consumers will
+         * still receive the remaining elements
+         */
+        void close() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                closed = true;
+            }
+            available.notify_all();
+        }
+    };
+}    // namespace GenreParser::Utilities
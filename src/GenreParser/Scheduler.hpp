@@ -0,0 +1,61 @@
+/**
+ * @file Scheduler.hpp
+ * @author Grama Nicolae (gramanicu@gmail.com)
+ * @brief Load balancer, used to choose the worker of each paragraph
+ * @copyright Copyright (c) 2020
+ */
+
+#pragma once
+
+#include <mutex>
+#include <vector>
+
+namespace GenreParser::Utilities {
+    /**
+     * @brief Counts the bytes that were assigned to each worker and not
+     * completed yet (queued on the master, or sent to the worker). New work
+     * goes to the worker with the least outstanding bytes
+     */
+    class Scheduler {
+       private:
+        std::vector<size_t> outstanding;
+        size_t next = 0;    // Where the search starts, to break the ties
+        std::mutex mutex;
+
+       public:
+        /**
+         * @brief Set the number of workers, all of them idle
+         * @param count The number of workers
+         */
+        void set_workers(size_t count) { outstanding.assign(count, 0); }
+
+        /**
+         * @brief Assign work to the least loaded worker
+         * @param bytes The size of the work
+         * @return The index of the worker
+         */
+        size_t assign(size_t bytes) {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            size_t best = next;
+            for (size_t i = 1; i < outstanding.size(); ++i) {
+                size_t worker = (next + i) % outstanding.size();
+                if (outstanding[worker] < outstanding[best]) { best = worker; }
+            }
+
+            outstanding[best] += bytes;
+            next = (best + 1) % outstanding.size();
+            return best;
+        }
+
+        /**
+         * @brief Mark work assigned with assign as completed
+         * @param worker The index of the worker
+         * @param bytes The size of the work
+         */
+        void complete(size_t worker, size_t bytes) {
+            std::lock_guard<std::mutex> lock(mutex);
+            outstanding[worker] -= bytes;
+        }
+    };
+}    // namespace GenreParser::Utilities
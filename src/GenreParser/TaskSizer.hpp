@@ -0,0 +1,62 @@
+/**
+ * @file TaskSizer.hpp
+ * @author Grama Nicolae (gramanicu@gmail.com)
+ * @brief Chooses the size of the tasks run by the thread pool
+ * @copyright Copyright (c) 2020
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+
+#include "Helpers.hpp"
+
+namespace GenreParser::Utilities {
+    /**
+     * @brief Keeps the number of bytes a task should process. When adaptive,
+     * the size is adjusted after each task, so that a task takes about the
+     * target time: large enough to hide the cost of a task, small enough to
+     * balance the load between the threads
+     */
+    class TaskSizer {
+       private:
+        std::atomic<size_t> size{Constants::DEFAULT_TASK_BYTES};
+        uint64_t target_time = 0;    // In nanoseconds, or 0 for a fixed size
+
+       public:
+        /**
+         * @brief Use a fixed task size
+         * @param bytes The size of a task
+         */
+        void set_fixed(size_t bytes) {
+            size = bytes;
+            target_time = 0;
+        }
+
+        /**
+         * @brief Adjust the task size, starting from the default one
+         * @param nanoseconds How long a task should take
+         */
+        void set_adaptive(uint64_t nanoseconds) { target_time = nanoseconds; }
+
+        size_t bytes() const { return size; }
+
+        /**
+         * @brief Adjust the size after a task was run. The new size is a
+         * moving average, so a single slow task doesn't change it too much
+         * @param bytes The bytes processed by the task
+         * @param nanoseconds How long the task took
+         */
+        void update(size_t bytes, uint64_t nanoseconds) {
+            if (target_time == 0 || bytes == 0 || nanoseconds == 0) { return; }
+
+            // The size that would have taken the target time
+            double measured = (double)bytes * target_time / nanoseconds;
+            measured = std::clamp(measured, (double)Constants::MIN_TASK_BYTES,
+                                  (double)Constants::MAX_TASK_BYTES);
+            size = (3 * size + (size_t)measured) / 4;
+        }
+    };
+}    // namespace GenreParser::Utilities
@@ -0,0 +1,116 @@
+/**
+ * @file ThreadPool.cpp
+ * @author Grama Nicolae (gramanicu@gmail.com)
+ * @brief Thread pool implementation
+ * @copyright Copyright (c) 2020
+ */
+
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+#include "Helpers.hpp"
+#include "Trace.hpp"
+
+namespace GenreParser {
+    ThreadPool::ThreadPool(int thread_count) {
+        thread_count = std::max(1, thread_count);
+
+        // Queue 0 belongs to the thread that submits the tasks
+        for (int i = 0; i < thread_count; ++i) {
+            queues.push_back(std::make_unique<TaskQueue>());
+        }
+        for (int i = 1; i < thread_count; ++i) {
+            threads.push_back(std::thread(&ThreadPool::work, this, i));
+        }
+    }
+
+    ThreadPool::~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+
+        for (auto& thread : threads) { thread.join(); }
+    }
+
+    void ThreadPool::submit(std::function<void()> task) {
+        TaskQueue& queue = *queues[next_queue];
+        next_queue = (next_queue + 1) % queues.size();
+
+        unfinished++;
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            queued++;
+        }
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back(std::move(task));
+        }
+        wake.notify_one();
+    }
+
+    bool ThreadPool::run_one(size_t self) {
+        std::function<void()> task;
+
+        // Take the newest task from its own queue, or the oldest one from
+        // the other queues
+        for (size_t i = 0; i < queues.size() && !task; ++i) {
+            TaskQueue& queue = *queues[(self + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+
+            if (queue.tasks.empty()) { continue; }
+            if (i == 0) {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            } else {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+        }
+
+        if (!task) { return false; }
+        queued--;
+        task();
+
+        if (--unfinished == 0) {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            done.notify_all();
+        }
+        return true;
+    }
+
+    void ThreadPool::work(size_t self) {
+        Trace::name_thread("pool-" + std::to_string(self));
+
+        while (true) {
+            if (run_one(self)) { continue; }
+
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            wake.wait(lock, [this] { return stopping || queued > 0; });
+            if (stopping && queued == 0) { return; }
+        }
+    }
+
+    void ThreadPool::wait(const std::function<void()>& progress) {
+        auto finished = [this] { return unfinished == 0; };
+
+        while (unfinished > 0) {
+            if (progress) { progress(); }
+            if (run_one(0)) { continue; }
+
+            // The remaining tasks are running on the other threads
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            if (progress) {
+                done.wait_for(
+                    lock,
+                    std::chrono::microseconds(Constants::PROGRESS_INTERVAL),
+                    finished);
+            } else {
+                done.wait(lock, finished);
+            }
+        }
+    }
+}    // namespace GenreParser
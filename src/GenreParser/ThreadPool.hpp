@@ -0,0 +1,84 @@
+/**
+ * @file ThreadPool.hpp
+ * @author Grama Nicolae (gramanicu@gmail.com)
+ * @brief Work-stealing thread pool, used by the workers
+ * @copyright Copyright (c) 2020
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace GenreParser {
+    /**
+     * @brief A pool of threads, created only once. Each thread has its own
+     * task queue, and steals tasks from the other queues when it is empty.
+     * The thread that submits the tasks also runs them, while it waits
+     */
+    class ThreadPool {
+       private:
+        struct TaskQueue {
+            std::deque<std::function<void()>> tasks;
+            std::mutex mutex;
+        };
+
+        std::vector<std::unique_ptr<TaskQueue>> queues;
+        std::vector<std::thread> threads;
+        size_t next_queue = 0;
+
+        std::atomic<size_t> queued{0};
+        std::atomic<size_t> unfinished{0};
+        bool stopping = false;
+
+        std::mutex sleep_mutex;
+        std::condition_variable wake;
+        std::condition_variable done;
+
+        /**
+         * @brief Run a task from the queue of the thread, or from another
+         * queue, if that one is empty
+         * @param self The index of the queue of the thread
+         * @return false if there were no tasks
+         */
+        bool run_one(size_t self);
+
+        /**
+         * @brief The code executed by each thread of the pool
+         * @param self The index of the queue of the thread
+         */
+        void work(size_t self);
+
+       public:
+        /**
+         * @brief Start the pool
+         * @param thread_count The number of threads that will run the tasks,
+         * including the one that waits for them
+         */
+        explicit ThreadPool(int thread_count);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        /**
+         * @brief Add a task to the pool. Only one thread should submit tasks
+         * @param task The task
+         */
+        void submit(std::function<void()> task);
+
+        /**
+         * @brief Run tasks until all the submitted tasks are finished
+         * @param progress If set, it is called between the tasks, and every
+         * PROGRESS_INTERVAL while the other threads finish theirs (so the
+         * waiting thread can also make progress on its communication)
+         */
+        void wait(const std::function<void()>& progress = nullptr);
+    };
+}    // namespace GenreParser
@@ -0,0 +1,257 @@
+/**
+ * @file Trace.cpp
+ * @author Grama Nicolae (gramanicu@gmail.com)
+ * @brief Instrumentation implementation
+ * @copyright Copyright (c) 2020
+ */
+
+#include "Trace.hpp"
+
+#include <mpi.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+#include "Helpers.hpp"
+
+namespace GenreParser::Trace {
+    namespace {
+        struct Event {
+            const char* stage;
+            uint64_t start;
+            uint64_t duration;
+            uint64_t bytes;
+        };
+
+        struct Stage {
+            const char* name;
+            uint64_t count = 0;
+            uint64_t time = 0;
+            uint64_t bytes = 0;
+        };
+
+        struct Thread {
+            std::string name;
+            std::vector<Stage> stages;
+            std::vector<Event> events;
+        };
+
+        bool enabled = false;
+        uint64_t epoch = 0;
+
+        // The records of all the threads of the node. Each thread only
+        // accesses its own records, until they are gathered
+        std::mutex threads_mutex;
+        std::vector<std::unique_ptr<Thread>> threads;
+        thread_local Thread* current = nullptr;
+
+        Thread& current_thread() {
+            if (current == nullptr) {
+                std::lock_guard<std::mutex> lock(threads_mutex);
+                threads.push_back(std::make_unique<Thread>());
+                current = threads.back().get();
+                current->name = "thread-" + std::to_string(threads.size() - 1);
+            }
+            return *current;
+        }
+
+        /**
+         * @brief Convert the records of the node to text, one record per
+         * line: "T thread name", "S thread stage count time bytes" and
+         * "E thread stage start duration bytes"
+         */
+        std::string serialize() {
+            std::lock_guard<std::mutex> lock(threads_mutex);
+            std::stringstream ss;
+
+            for (size_t id = 0; id < threads.size(); ++id) {
+                Thread& thread = *threads[id];
+                ss << "T " << id << " " << thread.name << "\n";
+                for (auto& stage : thread.stages) {
+                    ss << "S " << id << " " << stage.name << " " << stage.count
+                       << " " << stage.time << " " << stage.bytes << "\n";
+                }
+                for (auto& event : thread.events) {
+                    ss << "E " << id << " " << event.stage << " "
+                       << event.start << " " << event.duration << " "
+                       << event.bytes << "\n";
+                }
+            }
+            return ss.str();
+        }
+
+        /**
+         * @brief Print the stages of each thread, and add the events to the
+         * Chrome trace
+         * @param rank The rank of the node
+         * @param records The records of the node, from serialize
+         * @param trace The trace events, as JSON objects
+         */
+        void report(int rank, const std::string& records, std::ostream& trace) {
+            std::stringstream in(records);
+            std::string kind;
+            std::vector<std::string> names;
+
+            trace << (rank == 0 ? "" : ",\n")
+                  << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << rank
+                  << ",\"args\":{\"name\":\""
+                  << (rank == Constants::MASTER ? "Master"
+                                                : "Worker " +
+                                                      std::to_string(rank))
+                  << "\"}}";
+
+            while (in >> kind) {
+                size_t id;
+                in >> id;
+
+                if (kind == "T") {
+                    std::string name;
+                    in >> name;
+                    names.push_back(name);
+                    trace << ",\n{\"name\":\"thread_name\",\"ph\":\"M\","
+                             "\"pid\":"
+                          << rank << ",\"tid\":" << id
+                          << ",\"args\":{\"name\":\"" << name << "\"}}";
+                } else if (kind == "S") {
+                    std::string stage;
+                    uint64_t count, time, bytes;
+                    in >> stage >> count >> time >> bytes;
+
+                    double ms = time / 1e6;
+                    std::cerr << std::setw(6) << rank << "  " << std::left
+                              << std::setw(16) << names[id] << std::setw(16)
+                              << stage << std::right << std::setw(10) << count
+                              << std::setw(12) << std::fixed
+                              << std::setprecision(2) << ms << std::setw(14)
+                              << bytes << std::setw(10)
+                              << (time == 0 ? 0 : bytes * 1e3 / time) << "\n";
+                } else if (kind == "E") {
+                    std::string stage;
+                    uint64_t start, duration, bytes;
+                    in >> stage >> start >> duration >> bytes;
+
+                    trace << ",\n{\"name\":\"" << stage
+                          << "\",\"ph\":\"X\",\"pid\":" << rank
+                          << ",\"tid\":" << id << std::fixed
+                          << std::setprecision(3) << ",\"ts\":" << start / 1e3
+                          << ",\"dur\":" << duration / 1e3
+                          << ",\"args\":{\"bytes\":" << bytes << "}}";
+                }
+            }
+        }
+
+        /**
+         * @brief Print the summary of all the nodes and write the trace
+         * @param nodes The records of each node, by rank
+         * @param path Where the trace is written
+         */
+        void write_trace(const std::vector<std::string>& nodes,
+                         const std::string& path) {
+            std::ofstream trace(path);
+            trace << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+            std::cerr << "Trace summary (" << path << ")\n"
+                      << std::setw(6) << "rank" << "  " << std::left
+                      << std::setw(16) << "thread" << std::setw(16) << "stage"
+                      << std::right << std::setw(10) << "count"
+                      << std::setw(12) << "time (ms)" << std::setw(14)
+                      << "bytes" << std::setw(10) << "MB/s" << "\n";
+            for (size_t rank = 0; rank < nodes.size(); ++rank) {
+                report(rank, nodes[rank], trace);
+            }
+
+            trace << "\n]}\n";
+            Conditions::MUST(trace.good(),
+                             path + ": Trace could not be written\n");
+        }
+    }    // namespace
+
+    void enable() { enabled = true; }
+
+    bool is_enabled() { return enabled; }
+
+    void start() { epoch = now(); }
+
+    void name_thread(const std::string& name) {
+        if (enabled) { current_thread().name = name; }
+    }
+
+    void record(const char* stage, uint64_t start, uint64_t bytes) {
+        Thread& thread = current_thread();
+        uint64_t duration = now() - start;
+
+        // The stages are string literals, so they are compared by address
+        // first
+        Stage* found = nullptr;
+        for (auto& known : thread.stages) {
+            if (known.name == stage || std::strcmp(known.name, stage) == 0) {
+                found = &known;
+                break;
+            }
+        }
+        if (found == nullptr) {
+            thread.stages.push_back({stage});
+            found = &thread.stages.back();
+        }
+        found->count++;
+        found->time += duration;
+        found->bytes += bytes;
+
+        if (thread.events.size() < Constants::MAX_TRACE_EVENTS) {
+            thread.events.push_back({stage, start - epoch, duration, bytes});
+        }
+    }
+
+    void gather(int rank, const std::string& path) {
+        int count;
+        MPI_Comm_size(MPI_COMM_WORLD, &count);
+
+        // The records of a node can be larger than an int count, so they are
+        // sent in chunks, after their 64 bit size
+        std::string records = serialize();
+        if (rank != Constants::MASTER) {
+            uint64_t size = records.size();
+            MPI_Send(&size, 1, MPI_UINT64_T, Constants::MASTER,
+                     Constants::TRACE_TAG, MPI_COMM_WORLD);
+            for (size_t sent = 0; sent < size; sent += Constants::TRACE_CHUNK) {
+                int chunk =
+                    std::min<size_t>(Constants::TRACE_CHUNK, size - sent);
+                MPI_Send(records.data() + sent, chunk, MPI_CHAR,
+                         Constants::MASTER, Constants::TRACE_TAG,
+                         MPI_COMM_WORLD);
+            }
+            return;
+        }
+
+        std::vector<std::string> nodes(count);
+        nodes[Constants::MASTER] = std::move(records);
+        for (int node = 0; node < count; ++node) {
+            if (node == Constants::MASTER) { continue; }
+
+            uint64_t size;
+            MPI_Recv(&size, 1, MPI_UINT64_T, node, Constants::TRACE_TAG,
+                     MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            nodes[node].resize(size);
+            for (size_t received = 0; received < size;
+                 received += Constants::TRACE_CHUNK) {
+                int chunk =
+                    std::min<size_t>(Constants::TRACE_CHUNK, size - received);
+                MPI_Recv(&nodes[node][received], chunk, MPI_CHAR, node,
+                         Constants::TRACE_TAG, MPI_COMM_WORLD,
+                         MPI_STATUS_IGNORE);
+            }
+        }
+
+        write_trace(nodes, path);
+    }
+
+    void write(const std::string& path) { write_trace({serialize()}, path); }
+}    // namespace GenreParser::Trace
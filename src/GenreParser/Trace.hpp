@@ -0,0 +1,93 @@
+/**
+ * @file Trace.hpp
+ * @author Grama Nicolae (gramanicu@gmail.com)
+ * @brief Instrumentation of the processing stages, on every node and thread
+ * @copyright Copyright (c) 2020
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace GenreParser::Trace {
+    /**
+     * Every thread records the stages it runs (reading, sending, waiting,
+     * processing...): how many times, for how long and how many bytes.
+     * The first MAX_TRACE_EVENTS stages of each thread are also kept with
+     * their timestamps. When the tracing is disabled, nothing is recorded
+     */
+
+    /**
+     * @brief Enable the tracing. It must be called before the threads start
+     */
+    void enable();
+    bool is_enabled();
+
+    /**
+     * @brief Start the clock of the node. The recorded timestamps are
+     * relative to it
+     */
+    void start();
+
+    /**
+     * @brief The current time, in nanoseconds
+     */
+    inline uint64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    /**
+     * @brief Set the name of the current thread, as shown in the trace
+     */
+    void name_thread(const std::string& name);
+
+    /**
+     * @brief Record a stage of the current thread
+     * @param stage The name of the stage (a string literal)
+     * @param start When the stage started (from now())
+     * @param bytes The bytes processed in the stage
+     */
+    void record(const char* stage, uint64_t start, uint64_t bytes);
+
+    /**
+     * @brief Records the stage that lasts until the end of the scope
+     */
+    class Scope {
+       private:
+        const char* stage;
+        uint64_t start;
+        uint64_t bytes;
+
+       public:
+        explicit Scope(const char* stage, uint64_t bytes = 0)
+            : stage(stage), start(is_enabled() ? now() : 0), bytes(bytes) {}
+        ~Scope() {
+            if (is_enabled()) { record(stage, start, bytes); }
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+        void add_bytes(uint64_t count) { bytes += count; }
+    };
+
+    /**
+     * @brief Gather the records of all the nodes on the master, which prints
+     * a summary and writes a Chrome trace (it can be opened in Perfetto, or
+     * chrome://tracing). Every node must call it
+     * @param rank The rank of the node
+     * @param path Where the trace is written, on the master
+     */
+    void gather(int rank, const std::string& path);
+
+    /**
+     * @brief Print the summary and write the trace of this node only (when
+     * there is no MPI)
+     * @param path Where the trace is written
+     */
+    void write(const std::string& path);
+}    // namespace GenreParser::Trace